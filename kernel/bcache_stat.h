@@ -0,0 +1,19 @@
+#ifndef BCACHE_STAT_H
+#define BCACHE_STAT_H
+
+// Buffer cache statistics, as returned by the bcachestat() system
+// call. Counts are since boot; sizes are in buffers.
+struct bcachestat {
+  uint64 hits;       // bread()s that found the block cached
+  uint64 misses;     // bread()s that had to find a buffer for it
+  uint64 evictions;  // misses that recycled another block's buffer
+  uint64 readaheads; // blocks read ahead of a sequential reader
+  uint64 grows;      // pages of memory added to the cache
+  uint64 shrinks;    // pages given back to kalloc
+  uint nbuf;         // buffers in the cache now
+  uint max;          // the cache grows up to this many buffers
+  uint min;          // and never shrinks below this many
+  uint bsize;        // bytes per buffer
+};
+
+#endif
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,70 +22,400 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
+#include "bcache_stat.h"
+#include "virtio.h"
 
-struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+#define NBUCKET 13  // prime, so block numbers spread evenly
+#define BPERPG (PGSIZE / BSIZE)  // buffers per page of cache memory
+
+#if BSIZE > PGSIZE || PGSIZE % BSIZE != 0 || BSIZE % 512 != 0
+#error "BSIZE must divide PGSIZE and be a multiple of the sector size"
+#endif
 
-  // Linked list of all buffers, through prev/next.
+// Buffers are hashed by (dev, blockno) into buckets, each with its
+// own lock and LRU list, so lookups of different blocks do not
+// contend. A buffer stays in its bucket until it is recycled for
+// another block, which may move it to another bucket.
+struct bucket {
+  struct spinlock lock;  // protects the list and its bufs' refcnts
+
+  // Linked list of the bucket's buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+};
+
+// The cache grows a page at a time while there is spare memory,
+// up to bcache.max buffers, and gives pages back when kalloc runs
+// out. A bpage holds the headers of the buffers whose data is in
+// one such page; bpages themselves are carved out of kalloc'd
+// pages and reused, not freed.
+struct bpage {
+  struct bpage *next;    // bcache.pages, or bcache.freepg
+  uchar *data;
+  struct buf buf[BPERPG];
+};
+
+struct {
+  // Protects the free list and the page lists, and serializes
+  // recycling, growing and shrinking: the only paths that hold
+  // more than one bucket lock at once.
+  struct spinlock lock;
+
+  // Buffers holding no block (dev 0), not in any bucket.
+  struct buf free;
+
+  struct bpage *pages;   // pages in the cache
+  struct bpage *freepg;  // unused bpages
+  int nbuf;              // buffers in the cache
+  int max;               // limit on nbuf
+
+  struct bcachestat st;  // counters, updated atomically
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b at the head of the list at head.
+static void
+binsert(struct buf *head, struct buf *b)
+{
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+// Return an unused bpage, carving up a new page if there is none.
+// Caller holds bcache.lock.
+static struct bpage*
+bpagealloc(void)
+{
+  struct bpage *pg;
+  char *mem;
+  int i;
+
+  if(bcache.freepg == 0){
+    if((mem = kalloc_cache()) == 0)
+      return 0;
+    for(i = 0; i + sizeof(struct bpage) <= PGSIZE; i += sizeof(struct bpage)){
+      pg = (struct bpage*)(mem + i);
+      pg->next = bcache.freepg;
+      bcache.freepg = pg;
+    }
+  }
+  pg = bcache.freepg;
+  bcache.freepg = pg->next;
+  return pg;
+}
+
+// Add a page of buffers to the free list.
+// Returns 0 if the cache is at its limit or memory is short.
+static int
+bgrow(void)
+{
+  struct bpage *pg;
+  struct buf *b;
+  uchar *mem;
+
+  if((mem = kalloc_cache()) == 0)
+    return 0;
+  acquire(&bcache.lock);
+  if(bcache.nbuf + BPERPG > bcache.max || (pg = bpagealloc()) == 0){
+    release(&bcache.lock);
+    kfree(mem);
+    return 0;
+  }
+  pg->data = mem;
+  for(b = pg->buf; b < pg->buf+BPERPG; b++){
+    initsleeplock(&b->lock, "buffer");
+    b->data = mem + (b - pg->buf) * BSIZE;
+    b->dev = 0;
+    b->blockno = 0;
+    b->valid = 0;
+    b->disk = 0;
+    b->readahead = 0;
+    b->qnext = 0;
+    b->refcnt = 0;
+    binsert(&bcache.free, b);
+  }
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.nbuf += BPERPG;
+  release(&bcache.lock);
+  __sync_fetch_and_add(&bcache.st.grows, 1);
+  return 1;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  bcache.free.prev = &bcache.free;
+  bcache.free.next = &bcache.free;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
   }
+
+  bcache.max = NBUFMAX;
+  while(bcache.nbuf < NBUF)
+    if(!bgrow())
+      panic("binit");
+}
+
+// Look for the block in bk. Caller holds bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
+// In either case, return the buffer with a reference but not
+// locked, and set *hit if the block was already cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(uint dev, uint blockno, int *hit)
 {
   struct buf *b;
+  struct bucket *bk = bhash(dev, blockno);
+  struct bucket *victim;
+  int i;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = blookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    *hit = 1;
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached. Rather than evict, grow the cache while
+  // there is room and memory to spare.
+  if(bcache.free.next == &bcache.free && bcache.nbuf < bcache.max)
+    bgrow();
+
+  // Take the recycling lock, then look again: another process
+  // may have brought the block in meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    *hit = 1;
+    return b;
+  }
+  *hit = 0;
+
+  // Use a free buffer if there is one.
+  if((b = bcache.free.next) != &bcache.free){
+    bunlink(b);
+    victim = bk;
+    goto found;
+  }
+
+  // Otherwise recycle the least recently used unused buffer,
+  // from this bucket if possible, else stolen from the next
+  // bucket that has one.
+  for(i = 0; i < NBUCKET; i++){
+    victim = &bcache.bucket[(bk - bcache.bucket + i) % NBUCKET];
+    if(victim != bk)
+      acquire(&victim->lock);
+    for(b = victim->head.prev; b != &victim->head; b = b->prev){
+      if(b->refcnt == 0) {
+        bunlink(b);
+        __sync_fetch_and_add(&bcache.st.evictions, 1);
+        goto found;
+      }
     }
+    if(victim != bk)
+      release(&victim->lock);
   }
   panic("bget: no buffers");
+
+found:
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  binsert(&bk->head, b);
+  if(victim != bk)
+    release(&victim->lock);
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
+}
+
+// Return a locked buffer for the block, cached or not.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+  int hit;
+
+  b = bfind(dev, blockno, &hit);
+  __sync_fetch_and_add(hit ? &bcache.st.hits : &bcache.st.misses, 1);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Drop a reference to b, which must not be locked.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  // b cannot change buckets while refcnt > 0.
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    binsert(&bk->head, b);
+  }
+  
+  release(&bk->lock);
+}
+
+// Take pg's buffers out of the cache if none of them is in use.
+// Returns 1 if it did. Caller holds bcache.lock, which allows
+// holding several bucket locks at once.
+static int
+bpagedrop(struct bpage *pg)
+{
+  struct bucket *held[BPERPG];
+  struct bucket *bk;
+  struct buf *b;
+  int i, j, n, busy;
+
+  // Lock the distinct buckets of pg's buffers in address order.
+  n = 0;
+  for(b = pg->buf; b < pg->buf+BPERPG; b++){
+    if(b->dev == 0)
+      continue; // on the free list
+    bk = bhash(b->dev, b->blockno);
+    for(i = 0; i < n && held[i] < bk; i++)
+      ;
+    if(i < n && held[i] == bk)
+      continue;
+    for(j = n; j > i; j--)
+      held[j] = held[j-1];
+    held[i] = bk;
+    n++;
+  }
+  for(i = 0; i < n; i++)
+    acquire(&held[i]->lock);
+
+  busy = 0;
+  for(b = pg->buf; b < pg->buf+BPERPG; b++)
+    if(b->refcnt != 0)
+      busy = 1;
+  if(!busy)
+    for(b = pg->buf; b < pg->buf+BPERPG; b++)
+      bunlink(b);
+
+  for(i = 0; i < n; i++)
+    release(&held[i]->lock);
+  return !busy;
+}
+
+// Give up to npages pages of cache memory back to kalloc, without
+// shrinking below NBUF buffers or touching buffers in use.
+// Returns the number of pages freed.
+int
+bcache_reclaim(int npages)
+{
+  struct bpage *pg, **pp;
+  uchar *freed[16];
+  int n, total;
+
+  total = 0;
+  while(total < npages){
+    n = 0;
+    acquire(&bcache.lock);
+    for(pp = &bcache.pages; (pg = *pp) != 0 && n < NELEM(freed) &&
+          total + n < npages && bcache.nbuf - BPERPG >= NBUF; ){
+      if(bpagedrop(pg)){
+        *pp = pg->next;
+        freed[n++] = pg->data;
+        pg->next = bcache.freepg;
+        bcache.freepg = pg;
+        bcache.nbuf -= BPERPG;
+      } else {
+        pp = &pg->next;
+      }
+    }
+    release(&bcache.lock);
+
+    // kfree outside bcache.lock; kalloc may be waiting on it.
+    for(int i = 0; i < n; i++)
+      kfree(freed[i]);
+    __sync_fetch_and_add(&bcache.st.shrinks, n);
+    total += n;
+    if(n == 0)
+      break;
+  }
+  return total;
+}
+
+// Set the limit on the cache size to max buffers, shrinking the
+// cache now if it is over. Returns the limit actually set.
+int
+bcache_setmax(int max)
+{
+  int over;
+
+  if(max < NBUF)
+    max = NBUF;
+  acquire(&bcache.lock);
+  bcache.max = max;
+  over = bcache.nbuf - max;
+  release(&bcache.lock);
+  if(over > 0)
+    bcache_reclaim((over + BPERPG - 1) / BPERPG);
+  return max;
+}
+
+// Copy the cache statistics to the struct bcachestat at user addr.
+int
+bcache_stats(uint64 addr)
+{
+  struct bcachestat st;
+
+  acquire(&bcache.lock);
+  st = bcache.st;
+  st.nbuf = bcache.nbuf;
+  st.max = bcache.max;
+  release(&bcache.lock);
+  st.min = NBUF;
+  st.bsize = BSIZE;
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +432,18 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without reading it:
+// the caller is going to overwrite all of its contents.
+struct buf*
+bgetblank(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +453,23 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the n locked buffers bs[0..n-1] to disk, letting the
+// disk work on all of them at once, and wait for them all.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  virtio_disk_submit(bs, n, 1);
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of its bucket's most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +477,97 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Start reading the n blocks into the cache in the background,
+// skipping those that are cached already. Blocks that are next to
+// each other on disk are read with one request. Returns how many
+// of the blocks were dealt with: fewer than n if the disk queue
+// filled up, so the caller can ask again later.
+int
+breadahead(uint dev, uint *blocks, int n)
+{
+  struct buf *bs[MAXSEG];
+  int at[MAXSEG];
+  struct bucket *bk;
+  struct buf *b;
+  int i, j, nb, started, hit;
+
+  for(i = 0; i < n; ){
+    nb = 0;
+    for(; i < n && nb < MAXSEG; i++){
+      // Cheap check first: most read-ahead is for cached blocks.
+      bk = bhash(dev, blocks[i]);
+      acquire(&bk->lock);
+      b = blookup(bk, dev, blocks[i]);
+      release(&bk->lock);
+      if(b)
+        continue;
+
+      b = bfind(dev, blocks[i], &hit);
+      if(hit){
+        bput(b);
+        continue;
+      }
+      // Someone else may have found the fresh buffer and locked
+      // it first; if they read or wrote it, reading the disk now
+      // would overwrite newer contents.
+      acquiresleep(&b->lock);
+      if(b->valid){
+        releasesleep(&b->lock);
+        bput(b);
+        continue;
+      }
+      at[nb] = i;
+      bs[nb++] = b;
+    }
+
+    started = virtio_disk_read_async(bs, nb);
+    for(j = 0; j < started; j++){
+#ifdef LOCKDEP
+      // The lock now belongs to the I/O, which breadahead_done()
+      // releases from the disk interrupt.
+      lockdep_release(&bs[j]->lock, LD_SLEEP);
+#endif
+    }
+    __sync_fetch_and_add(&bcache.st.readaheads, started);
+    if(started < nb){
+      for(j = started; j < nb; j++){
+        releasesleep(&bs[j]->lock);
+        bput(bs[j]);
+      }
+      return at[started];
+    }
   }
-  
-  release(&bcache.lock);
+  return n;
+}
+
+// The read started by breadahead() has finished. Called from
+// virtio_disk_intr(); readers waiting in bread() can go ahead.
+void
+breadahead_done(struct buf *b)
+{
+  b->valid = 1;
+  b->readahead = 0;
+  releasesleep(&b->lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
-
@@ -1,12 +1,14 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int readahead; // read-ahead in flight, finished by virtio_disk_intr()
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // bucket LRU list
   struct buf *next;
-  uchar data[BSIZE];
+  struct buf *qnext; // next buf in the same disk request
+  uchar *data;      // BSIZE bytes in a page of cache memory
 };
 
@@ -12,10 +12,17 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetblank(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bcache_reclaim(int);
+int             breadahead(uint, uint*, int);
+void            breadahead_done(struct buf*);
+int             bcache_setmax(int);
+int             bcache_stats(uint64);
 
 // console.c
 void            consoleinit(void);
@@ -38,6 +45,7 @@ int             filewrite(struct file*, uint64, int n);
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
@@ -52,7 +60,10 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
-void            itrunc(struct inode*);
+int             itrunc(struct inode*);
+uint            ibmap(struct inode*, uint);
+int             iorphanwait(void);
+int             icache_stats(uint64);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -61,6 +72,7 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_cache(void);
 void            kfree(void *);
 void*           kalloc_huge(void);
 void            kfree_huge(void *pa);
@@ -69,11 +81,22 @@ uint64          freemem_amount(void);
 void            inc_ref(void*);
 int             get_ref(void*);
 
+// lockdep.c
+void            lockdep_acquire(void*, char*, int*, int);
+void            lockdep_release(void*, int);
+
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_write_data(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+void            log_force(void);
+void            log_free(uint);
+void            log_crash(int, int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -105,6 +128,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -185,7 +209,9 @@ void            grouplock_init(void);
 int             verify_group_properties(void);
 int             verify_deadlock_freedom(void);
 int             verify_atomic_group_operations(void);
-void            grouplock_debug_info(int group_id);
+void            grouplock_debug_info(uint64 key);
+int             grouplock_uvmcopy(pagetable_t, pagetable_t);
+void            grouplock_uvmunmap(pagetable_t);
 
 // plic.c
 void            plicinit(void);
@@ -196,6 +222,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_read_async(struct buf **, int);
+void            virtio_disk_submit(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -146,28 +146,34 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
+    // write as many blocks at a time as the log lets one
+    // operation have, leaving room for the
     // i-node, indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int nop = log_maxop();
+    int max = ((nop-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opn(nop);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nop);
 
       if(r != n1){
-        // error from writei
+        // error from writei, or out of blocks; blocks of
+        // unlinked or truncated files may yet come free.
+        if(r >= 0 && iorphanwait()){
+          i += r;
+          continue;
+        }
         break;
       }
       i += r;
@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *prev; // itable bucket list
+  struct inode *next;
+  struct inode *onext; // next orphan for ireclaim (fs.c)
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +29,20 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  union {
+    uint addrs[NADDRS];
+    char idata[NINLINE];
+  };
+  uint leaf;          // last block of data block numbers bmap() read
+  uint leafbn;        // file block number of its first entry
+  uint goal;          // where to look for its next free block
+  struct dirhash *dh; // directory index, or 0
+
+  // Read-ahead state, also protected by lock.
+  uint ra_off;        // where the last readi() ended
+  uint ra_end;        // read-ahead has been started for blocks below this
+  uint ra_win;        // read-ahead window in blocks, 0 if not sequential
 };
 
 // map major device number to device functions.
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "icache_stat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -37,49 +38,173 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bsuminit(int);
+static void dirhash_free(struct inode*);
+static void dcache_purge(struct inode*);
+static int itruncstep(struct inode*);
+static int itruncsmall(struct inode*);
+static void iorphan(struct inode*);
+static void iorphaninit(int);
+
 // Init fs
 void
 fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.bsize != BSIZE)
+    panic("fsinit: file system block size is not BSIZE");
   initlog(dev, &sb);
+  bsuminit(dev);
+  iorphaninit(dev);
 }
 
-// Zero a block.
+// Zero a block, which will hold file data if data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_write_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// ballocn() scans the bitmap a 64-bit word at a time, starting
+// from a goal block, usually just after the block the file got
+// last, so that files grow contiguously. A write that extends a
+// file by several whole blocks takes them in one contiguous run.
+// An in-memory count of the free blocks each bitmap block
+// describes lets ballocn() skip full bitmap blocks without
+// reading them.
+//
+// Blocks are zeroed when allocated, except file data blocks that
+// writei() is about to overwrite completely: zeroing is put off
+// until it is known to be needed, which for those is never.
+
+static struct {
+  uint *nfree;  // free blocks per bitmap block; updated with
+                // that bitmap block's buffer locked
+  uint nbmap;   // number of bitmap blocks
+  uint last;    // block after the last one allocated
+} bsum;
+
+// Number of clear bits in w.
+static int
+nzero(uint64 w)
+{
+  int n;
+
+  for(n = 0; w != ~0UL; n++)
+    w |= w + 1;  // set the lowest clear bit
+  return n;
+}
+
+// Index of the lowest clear bit in w, which is not ~0.
+static int
+firstzero(uint64 w)
+{
+  int i;
+
+  for(i = 0; w & 1; i++)
+    w >>= 1;
+  return i;
+}
+
+// Mark bits from sb.size up as in use in bitmap block bn's
+// data, as a copy in w, so that scans stop at the end of the disk.
+static uint64
+bclip(uint bn, int wi, uint64 w)
+{
+  uint b = bn * BPB + wi * 64;
+
+  if(b >= sb.size)
+    return ~0UL;
+  if(sb.size - b < 64)
+    w |= ~0UL << (sb.size - b);
+  return w;
+}
+
+// Count the free blocks described by each bitmap block.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  uint64 *w;
+  uint bn;
+  int wi;
+
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap * sizeof(uint) > PGSIZE)
+    panic("bsuminit: disk too big");
+  if((bsum.nfree = kalloc()) == 0)
+    panic("bsuminit");
+  for(bn = 0; bn < bsum.nbmap; bn++){
+    bp = bread(dev, BBLOCK(bn * BPB, sb));
+    w = (uint64*)bp->data;
+    bsum.nfree[bn] = 0;
+    for(wi = 0; wi < BSIZE/8; wi++)
+      bsum.nfree[bn] += nzero(bclip(bn, wi, w[wi]));
+    brelse(bp);
+  }
+}
 
-// Allocate a zeroed disk block.
+// Allocate up to *n contiguous disk blocks, for file data if
+// data is set, preferring the first free one at or after goal.
+// They are zeroed if zero is set. Returns the first block and
+// sets *n to the number allocated, which is at least 1.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+ballocn(uint dev, uint goal, int *n, int data, int zero)
 {
-  int b, bi, m;
   struct buf *bp;
-
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+  uint64 *w, x;
+  uint bn, b, i;
+  int k, wi, from, cnt;
+
+  if(goal >= sb.size)
+    goal = 0;
+  // Visit the goal's bitmap block last again, for the
+  // part of it before the goal.
+  for(k = 0; k <= bsum.nbmap; k++){
+    bn = (goal / BPB + k) % bsum.nbmap;
+    if(bsum.nfree[bn] == 0)
+      continue;
+    from = k == 0 ? goal % BPB : 0;
+    bp = bread(dev, BBLOCK(bn * BPB, sb));
+    w = (uint64*)bp->data;
+    for(wi = from / 64; wi < BSIZE/8; wi++){
+      x = bclip(bn, wi, w[wi]);
+      if(wi == from / 64)
+        x |= (1UL << (from % 64)) - 1;  // bits before the goal
+      if(x == ~0UL)
+        continue;
+
+      // Take the free bit and as many free bits after it
+      // as the caller wants, up to the end of this block.
+      b = bn * BPB + wi * 64 + firstzero(x);
+      for(cnt = 0; cnt < *n && b + cnt < sb.size; cnt++){
+        i = (b + cnt) % BPB;
+        if(i == 0 && cnt > 0)
+          break;
+        if(bp->data[i/8] & (1 << (i % 8)))
+          break;
+        bp->data[i/8] |= 1 << (i % 8);  // Mark block in use.
       }
+      bsum.nfree[bn] -= cnt;
+      log_write(bp);
+      brelse(bp);
+      for(i = 0; zero && i < cnt; i++)
+        bzero(dev, b + i, data);
+      bsum.last = b + cnt;
+      *n = cnt;
+      return b;
     }
     brelse(bp);
   }
@@ -100,8 +225,10 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  bsum.nfree[b / BPB]++;
   log_write(bp);
   brelse(bp);
+  log_free(b);
 }
 
 // Inodes.
@@ -130,17 +257,20 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   may be recycled for another inode if ip->ref is zero.
+//   Otherwise ip->ref tracks the number of in-memory
+//   pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry
+//   and increments its ref; iput() decrements ref. An
+//   entry whose ref has fallen to zero stays in the table,
+//   still valid, until it is recycled, so iget() of a
+//   recently used inode need not read it again.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,29 +294,144 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is hashed by (dev, inum) into buckets, like the
+// buffer cache. A bucket's spin-lock protects its list and the
+// ref of the inodes on it. Since ip->ref indicates whether an
+// entry may be recycled, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold the bucket lock while
+// using any of those fields. itable.lock protects the free list
+// and serializes recycling, which moves entries between buckets.
+//
+// The table starts with NINODE entries and grows a page at a
+// time while memory allows, up to itable.max, which is set
+// from the amount of memory at boot.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 31  // prime, so inode numbers spread evenly
+#define IPERPG (PGSIZE / sizeof(struct inode))  // inodes per page
+
+struct ibucket {
+  struct spinlock lock;
+
+  // Linked list of the bucket's inodes, through prev/next,
+  // most recently used first.
+  struct inode head;
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode free;    // entries holding no inode, in no bucket
+  int ninode;           // entries in the table
+  int max;              // limit on ninode
+  struct icachestat st; // counters, updated atomically
+  struct ibucket bucket[NIBUCKET];
 } itable;
 
+static struct ibucket*
+ihash(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 31 + inum) % NIBUCKET];
+}
+
+static void
+iunlink(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Insert ip at the head of the list at head.
+static void
+iinsert(struct inode *head, struct inode *ip)
+{
+  ip->next = head->next;
+  ip->prev = head;
+  head->next->prev = ip;
+  head->next = ip;
+}
+
+// Add a page of entries to the free list.
+// Returns 0 if the table is at its limit or memory is short.
+static int
+igrow(void)
+{
+  struct inode *ip, *pg;
+
+  if((pg = kalloc_cache()) == 0)
+    return 0;
+  acquire(&itable.lock);
+  if(itable.ninode + IPERPG > itable.max){
+    release(&itable.lock);
+    kfree(pg);
+    return 0;
+  }
+  for(ip = pg; ip < pg + IPERPG; ip++){
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    iinsert(&itable.free, ip);
+  }
+  itable.ninode += IPERPG;
+  release(&itable.lock);
+  __sync_fetch_and_add(&itable.st.grows, 1);
+  return 1;
+}
+
+// Directory entry cache: remembers what dirlookup() found for
+// (directory, name), including that there was nothing, so that
+// namex() can walk a path it has seen before without locking the
+// directories or reading them. dirlink() and dirunlink() keep it
+// in step with the directories, while holding the directory's
+// lock, and a directory's entries go when it is freed.
+//
+// It is set-associative: a name can only be in one of the
+// DC_WAYS entries of the set it hashes to, and the least
+// recently used of those makes room for a new one. Names longer
+// than DC_NAMELEN are not cached.
+
+#define DC_SETS 64
+#define DC_WAYS 4
+#define DC_NAMELEN 27
+
+struct dentry {
+  uint dev;
+  uint parent;          // directory's inum, 0 if the entry is free
+  uint inum;            // 0 if the directory has no such name
+  char name[DC_NAMELEN+1];
+  uint used;            // dcache.clock when last used
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dentry set[DC_SETS][DC_WAYS];
+} dcache;
+
 void
 iinit()
 {
-  int i = 0;
-  
+  struct ibucket *bk;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  initlock(&dcache.lock, "dcache");
+  itable.free.prev = &itable.free;
+  itable.free.next = &itable.free;
+  for(bk = itable.bucket; bk < itable.bucket+NIBUCKET; bk++){
+    initlock(&bk->lock, "itable.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
   }
+
+  // Up to 1/64th of memory, in whole pages. freemem_amount()
+  // counts KB.
+  itable.max = freemem_amount() * 1024 / PGSIZE / 64 * IPERPG;
+  if(itable.max < NINODE)
+    itable.max = (NINODE + IPERPG - 1) / IPERPG * IPERPG;
+  while(itable.ninode < NINODE)
+    if(!igrow())
+      panic("iinit");
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -208,6 +453,8 @@ ialloc(uint dev, short type)
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if(type == T_FILE)
+        dip->flags = DI_INLINE;  // until it grows
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -235,7 +482,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  dip->flags = ip->flags;
+  memmove(dip->idata, ip->idata, sizeof(ip->idata));
   log_write(bp);
   brelse(bp);
 }
@@ -243,34 +491,95 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Look for the inode in bk. Caller holds bk->lock.
+static struct inode*
+ilookup(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head.next; ip != &bk->head; ip = ip->next)
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  return 0;
+}
+
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *bk = ihash(dev, inum);
+  struct ibucket *victim;
+  int i;
+
+  // Is the inode already in the table?
+  acquire(&bk->lock);
+  if((ip = ilookup(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    __sync_fetch_and_add(&itable.st.hits, 1);
+    return ip;
+  }
+  release(&bk->lock);
+
+  // Not there. Rather than recycle, grow the table
+  // while there is room and memory to spare.
+  if(itable.free.next == &itable.free && itable.ninode < itable.max)
+    igrow();
 
+  // Take the recycling lock, then look again: another process
+  // may have brought the inode in meanwhile.
   acquire(&itable.lock);
+  acquire(&bk->lock);
+  if((ip = ilookup(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    release(&itable.lock);
+    __sync_fetch_and_add(&itable.st.hits, 1);
+    return ip;
+  }
+  __sync_fetch_and_add(&itable.st.misses, 1);
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  // Use a free entry if there is one.
+  if((ip = itable.free.next) != &itable.free){
+    iunlink(ip);
+    victim = bk;
+    goto found;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Otherwise recycle the least recently used unreferenced
+  // entry, from this bucket if possible, else stolen from the
+  // next bucket that has one.
+  for(i = 0; i < NIBUCKET; i++){
+    victim = &itable.bucket[(bk - itable.bucket + i) % NIBUCKET];
+    if(victim != bk)
+      acquire(&victim->lock);
+    for(ip = victim->head.prev; ip != &victim->head; ip = ip->prev){
+      if(ip->ref == 0){
+        iunlink(ip);
+        __sync_fetch_and_add(&itable.st.evictions, 1);
+        goto found;
+      }
+    }
+    if(victim != bk)
+      release(&victim->lock);
+  }
+  panic("iget: no inodes");
 
-  ip = empty;
+found:
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ra_off = 0;
+  ip->ra_end = 0;
+  ip->ra_win = 0;
+  ip->leaf = 0;
+  ip->goal = 0;
+  dirhash_free(ip);
+  iinsert(&bk->head, ip);
+  if(victim != bk)
+    release(&victim->lock);
+  release(&bk->lock);
   release(&itable.lock);
 
   return ip;
@@ -281,9 +590,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -308,7 +619,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->flags = dip->flags;
+    memmove(ip->idata, dip->idata, sizeof(ip->idata));
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -330,13 +642,18 @@ iunlock(struct inode *ip)
 // If that was the last reference, the inode table entry can
 // be recycled.
 // If that was the last reference and the inode has no links
-// to it, free the inode (and its content) on disk.
+// to it, free the inode (and its content) on disk, or, if it
+// has too many blocks for one transaction, make it an orphan.
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  // ip cannot change buckets while ref > 0.
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+  int big;
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,20 +662,54 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
-
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
-    ip->valid = 0;
+    release(&bk->lock);
+
+    if(ip->type == T_DIR)
+      dcache_purge(ip);
+    big = !itruncsmall(ip);
+    if(!big){
+      itruncstep(ip);
+      dirhash_free(ip);
+      ip->type = 0;
+      iupdate(ip);
+      ip->valid = 0;
+    }
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
+    if(big){
+      // Too many blocks to free in the caller's transaction.
+      // ireclaim frees them, and then ip, in transactions of its
+      // own, holding a reference of its own.
+      ip->ref++;
+      iorphan(ip);
+    }
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    // keep it cached, least likely to be recycled.
+    iunlink(ip);
+    iinsert(&bk->head, ip);
+  }
+  release(&bk->lock);
+}
+
+// Copy the inode table statistics to the struct icachestat
+// at user addr.
+int
+icache_stats(uint64 addr)
+{
+  struct icachestat st;
+
+  acquire(&itable.lock);
+  st = itable.st;
+  st.ninode = itable.ninode;
+  st.max = itable.max;
   release(&itable.lock);
+  st.min = NINODE;
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
 }
 
 // Common idiom: unlock, then put.
@@ -374,82 +725,514 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the next NDINDIRECT
+// in the blocks listed in block ip->addrs[NDIRECT+1], and
+// the last NTINDIRECT one level further down, under
+// ip->addrs[NDIRECT+2].
+//
+// The inode remembers the last block of data block numbers
+// that bmap() read, so that sequential access only reads
+// that block, not the ones above it.
+
+// Allocate a block for ip, right after the last one it got,
+// or for a file that has none yet, after the last one any got.
+// Zero it unless fresh is set. If n is not null, allocate a run
+// of up to *n contiguous blocks, and set *n to how many.
+static uint
+ibmalloc(struct inode *ip, int data, int fresh, int *n)
+{
+  uint addr;
+  int one = 1;
+
+  if(n == 0)
+    n = &one;
+  addr = ballocn(ip->dev, ip->goal ? ip->goal : bsum.last, n, data, !fresh);
+  if(addr)
+    ip->goal = addr + *n;
+  return addr;
+}
+
+// Number of zero entries at the start of a, up to max.
+static int
+nholes(uint *a, int max)
+{
+  int i;
+
+  for(i = 0; i < max && a[i] == 0; i++)
+    ;
+  return i;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
+// If fresh is not null, a newly allocated data block is left
+// unzeroed, and *fresh says whether that happened: the caller
+// must then fill in all of it.
+// If run is also not null, a newly allocated block comes with
+// up to *run - 1 more for the following blocks of the file that
+// have none yet, contiguous on disk and unzeroed like it, as far
+// as one bitmap block and one block of block numbers allow;
+// *run says how many blocks the caller now must fill.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmapw(struct inode *ip, uint bn, int *fresh, int *run)
 {
-  uint addr, *a;
+  uint addr, *a, fbn, span, i;
   struct buf *bp;
-
+  int level, data, want;
+
+  if(ip->flags & DI_INLINE)
+    panic("bmap: inline");
+  data = ip->type == T_FILE;
+  if(fresh)
+    *fresh = 0;
+  want = 1;
+  if(run){
+    want = *run;
+    *run = 1;
+  }
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      want = nholes(ip->addrs + bn, min(want, NDIRECT - bn));
+      addr = ibmalloc(ip, data, fresh != 0, &want);
       if(addr == 0)
         return 0;
-      ip->addrs[bn] = addr;
+      for(i = 0; i < want; i++)
+        ip->addrs[bn + i] = addr + i;
+      if(fresh)
+        *fresh = 1;
+      if(run)
+        *run = want;
     }
     return addr;
   }
+
+  fbn = bn;
+  if(ip->leaf && fbn - ip->leafbn < NINDIRECT){
+    addr = ip->leaf;
+    bn = fbn - ip->leafbn;
+    goto leaf;
+  }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+  // Which tree is it in: singly, doubly or triply indirect?
+  // span is how many data blocks the tree holds.
+  for(level = 0, span = NINDIRECT; bn >= span; level++, span *= NINDIRECT){
+    bn -= span;
+    if(level == 2)
+      panic("bmap: out of range");
+  }
+
+  // Load the top of the tree, allocating if necessary.
+  if((addr = ip->addrs[NDIRECT+level]) == 0){
+    addr = ibmalloc(ip, 0, 0, 0);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+level] = addr;
+  }
+
+  // Walk down to the block of data block numbers.
+  for(; level > 0; level--){
+    span /= NINDIRECT;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    i = bn / span;
+    bn %= span;
+    if((addr = a[i]) == 0){
+      addr = ibmalloc(ip, 0, 0, 0);
       if(addr){
-        a[bn] = addr;
+        a[i] = addr;
         log_write(bp);
       }
     }
     brelse(bp);
-    return addr;
+    if(addr == 0)
+      return 0;
+  }
+  ip->leaf = addr;
+  ip->leafbn = fbn - bn;
+
+leaf:
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[bn]) == 0){
+    want = nholes(a + bn, min(want, NINDIRECT - bn));
+    addr = ibmalloc(ip, data, fresh != 0, &want);
+    if(addr){
+      for(i = 0; i < want; i++)
+        a[bn + i] = addr + i;
+      log_write(bp);
+      if(fresh)
+        *fresh = 1;
+      if(run)
+        *run = want;
+    }
   }
+  brelse(bp);
+  return addr;
+}
 
-  panic("bmap: out of range");
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  return bmapw(ip, bn, 0, 0);
 }
 
-// Truncate inode (discard contents).
+// Return the disk block address of the nth block in inode ip,
+// or 0 if it has none; unlike bmap(), never allocate.
 // Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+uint
+ibmap(struct inode *ip, uint bn)
+{
+  uint addr, span, i;
+  struct buf *bp;
+  int level;
+
+  if(ip->flags & DI_INLINE)
+    return 0;
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+  for(level = 0, span = NINDIRECT; bn >= span; level++, span *= NINDIRECT){
+    bn -= span;
+    if(level == 2)
+      return 0;
+  }
+  addr = ip->addrs[NDIRECT+level];
+  for(; addr && level >= 0; level--){
+    span /= NINDIRECT;
+    bp = bread(ip->dev, addr);
+    i = bn / span;
+    bn %= span;
+    addr = ((uint*)bp->data)[i];
+    brelse(bp);
+  }
+  return addr;
+}
+
+// Bitmap blocks one step of itrunc() may dirty. Along with the
+// inode and a path of indirect blocks, that keeps a step within
+// MAXOPBLOCKS, even in a transaction the caller has begun to use.
+#define TRUNCBMAP 2
+
+// One step of itrunc(): the bitmap blocks it has dirtied.
+struct trunc {
+  int dev;
+  int nbmap;
+  uint bmap[TRUNCBMAP];
+};
+
+// Free block b as part of step t, unless that would dirty more
+// bitmap blocks than a step may. Returns 0 if b is left for the
+// next step.
+static int
+tfree(struct trunc *t, uint b)
+{
+  uint bb;
+  int i;
+
+  bb = BBLOCK(b, sb);
+  for(i = 0; i < t->nbmap; i++)
+    if(t->bmap[i] == bb)
+      break;
+  if(i == t->nbmap){
+    if(t->nbmap == TRUNCBMAP)
+      return 0;
+    t->bmap[t->nbmap++] = bb;
+  }
+  bfree(t->dev, b);
+  return 1;
+}
+
+// Free the indirect block addr and everything below it, as far
+// as step t allows; depth is 1 if it lists data blocks, 2 if it
+// lists blocks that do, and so on. Returns 1 if it is all free;
+// if not, addr lists what is left.
+static int
+bfreeind(struct trunc *t, uint addr, int depth)
 {
-  int i, j;
   struct buf *bp;
   uint *a;
+  int j, left, changed;
+
+  bp = bread(t->dev, addr);
+  a = (uint*)bp->data;
+  left = changed = 0;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1 ? !bfreeind(t, a[j], depth - 1) : !tfree(t, a[j])){
+      left = 1;
+      break;
+    }
+    a[j] = 0;
+    changed = 1;
+  }
+  if(!left && tfree(t, addr)){
+    brelse(bp);
+    return 1;
+  }
+  if(changed)
+    log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Free as many of ip's blocks as one step may, leaving the
+// rest consistent. Returns 1 if they are all free.
+// Caller must hold ip->lock and call iupdate().
+static int
+itruncstep(struct inode *ip)
+{
+  struct trunc t;
+  int i;
 
+  if(ip->flags & DI_INLINE){
+    memset(ip->idata, 0, sizeof(ip->idata));
+    return 1;
+  }
+
+  t.dev = ip->dev;
+  t.nbmap = 0;
+  ip->leaf = 0;
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      if(!tfree(&t, ip->addrs[i]))
+        return 0;
       ip->addrs[i] = 0;
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = NDIRECT; i < NADDRS; i++){
+    if(ip->addrs[i]){
+      if(!bfreeind(&t, ip->addrs[i], i - NDIRECT + 1))
+        return 0;
+      ip->addrs[i] = 0;
     }
+  }
+  return 1;
+}
+
+// Can one step free all of ip's blocks? Only if they are
+// direct blocks in at most TRUNCBMAP bitmap blocks.
+static int
+itruncsmall(struct inode *ip)
+{
+  uint bmap[TRUNCBMAP], bb;
+  int i, j, n;
+
+  if(ip->flags & DI_INLINE)
+    return 1;
+  for(i = NDIRECT; i < NADDRS; i++)
+    if(ip->addrs[i])
+      return 0;
+  n = 0;
+  for(i = 0; i < NDIRECT; i++){
+    if(ip->addrs[i] == 0)
+      continue;
+    bb = BBLOCK(ip->addrs[i], sb);
+    for(j = 0; j < n; j++)
+      if(bmap[j] == bb)
+        break;
+    if(j == n){
+      if(n == TRUNCBMAP)
+        return 0;
+      bmap[n++] = bb;
+    }
+  }
+  return 1;
+}
+
+// Orphans.
+//
+// A file with more blocks than one transaction can free is freed
+// in several, by the ireclaim kernel thread. The blocks belong to
+// an orphan: an inode with no links, which nothing but ireclaim
+// refers to. iput() makes the unlinked inode itself an orphan;
+// itrunc() moves the blocks to a new one, so that the file is
+// empty at once, and nobody writing it can meet half-freed blocks.
+//
+// An orphan needs no other record on disk than nlink == 0: at boot
+// no file is open, so iorphaninit() hands every inode with a type
+// and no links to ireclaim, finishing what a crash interrupted.
+// Until ireclaim gets to them, the blocks are not free: a write
+// that finds the disk full waits for it with iorphanwait().
+
+struct {
+  struct spinlock lock;
+  struct inode *head;  // queue of orphans, through onext
+  struct inode *tail;
+  uint nqueued;        // orphans ever queued
+  uint nfreed;         // orphans ever freed, in queue order
+} orphans;
+
+static void ireclaim(void);
+
+// Queue orphan ip for ireclaim, which takes over the caller's
+// reference.
+static void
+iorphan(struct inode *ip)
+{
+  acquire(&orphans.lock);
+  ip->onext = 0;
+  if(orphans.head == 0)
+    orphans.head = ip;
+  else
+    orphans.tail->onext = ip;
+  orphans.tail = ip;
+  orphans.nqueued++;
+  wakeup(&orphans);
+  release(&orphans.lock);
+}
+
+// Queue the orphans left on disk by a crash, and start ireclaim.
+static void
+iorphaninit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  int inum, orphan;
+
+  initlock(&orphans.lock, "orphans");
+  for(inum = 1; inum < sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    orphan = dip->type != 0 && dip->nlink == 0;
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    if(orphan)
+      iorphan(iget(dev, inum));
+  }
+  kthread(ireclaim, "ireclaim");
+}
+
+// Free orphan ip, one step per transaction, and drop the
+// reference to it.
+static void
+ifree(struct inode *ip)
+{
+  int done;
+
+  do {
+    begin_op();
+    ilock(ip);
+    done = itruncstep(ip);
+    if(done){
+      dirhash_free(ip);
+      ip->type = 0;
+    }
+    iupdate(ip);
+    if(done)
+      ip->valid = 0;
+    iunlock(ip);
+    end_op();
+  } while(!done);
+
+  begin_op();
+  iput(ip);
+  end_op();
+}
+
+// Kernel thread that frees orphans.
+static void
+ireclaim(void)
+{
+  struct inode *ip;
+
+  acquire(&orphans.lock);
+  for(;;){
+    if((ip = orphans.head) == 0){
+      sleep(&orphans, &orphans.lock);
+      continue;
+    }
+    orphans.head = ip->onext;
+    release(&orphans.lock);
+
+    ifree(ip);
+
+    acquire(&orphans.lock);
+    orphans.nfreed++;
+    wakeup(&orphans.nfreed);
+  }
+}
+
+// Wait until ireclaim has freed every orphan queued so far, for
+// fsync(), or for a write that ran out of blocks. Returns 0 if
+// there were none. Caller must not be in a transaction.
+int
+iorphanwait(void)
+{
+  uint n;
+  int waited;
+
+  acquire(&orphans.lock);
+  n = orphans.nqueued;
+  waited = orphans.nfreed != n;
+  while((int)(orphans.nfreed - n) < 0)
+    sleep(&orphans.nfreed, &orphans.lock);
+  release(&orphans.lock);
+  return waited;
+}
+
+// Truncate inode (discard contents), in the caller's transaction.
+// Caller must hold ip->lock. If the blocks are too many to free
+// in one go, they move to a new orphan for ireclaim to free.
+// Returns -1 if that needs an inode and there is none.
+int
+itrunc(struct inode *ip)
+{
+  struct inode *op;
+
+  if(itruncsmall(ip)){
+    if(!itruncstep(ip))
+      panic("itrunc");
+  } else {
+    if((op = ialloc(ip->dev, T_FILE)) == 0)
+      return -1;
+    ilock(op);
+    op->flags = 0;
+    memmove(op->addrs, ip->addrs, sizeof(op->addrs));
+    iupdate(op);
+    iunlock(op);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->leaf = 0;
+    iorphan(op);
   }
 
+  // addrs[] is all zero, so idata is empty.
+  if(ip->type == T_FILE)
+    ip->flags |= DI_INLINE;
   ip->size = 0;
   iupdate(ip);
+  return 0;
+}
+
+// Move the contents of inline file ip out to a data block,
+// so that it can grow past NINLINE bytes.
+// Returns 0 on success, -1 if out of disk space.
+static int
+iexpand(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+  uint addr;
+  int fresh;
+
+  memmove(data, ip->idata, sizeof(data));
+  memset(ip->idata, 0, sizeof(ip->idata));
+  ip->flags &= ~DI_INLINE;
+  if(ip->size == 0)
+    return 0;
+  if((addr = bmapw(ip, 0, &fresh, 0)) == 0){
+    memmove(ip->idata, data, sizeof(data));
+    ip->flags |= DI_INLINE;
+    return -1;
+  }
+  bp = fresh ? bgetblank(ip->dev, addr) : bread(ip->dev, addr);
+  memmove(bp->data, data, ip->size);
+  memset(bp->data + ip->size, 0, BSIZE - ip->size);
+  log_write_data(bp);
+  brelse(bp);
+  return 0;
 }
 
 // Copy stat information from inode.
@@ -464,6 +1247,50 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+#define RAMIN 4   // initial read-ahead window, in blocks
+#define RAMAX 32  // largest read-ahead window
+
+// Called by readi() for a read of n bytes at off. If reads of ip
+// have been sequential, start reading the blocks after this one
+// into the buffer cache so that later readi()s do not wait for
+// the disk. The window of blocks kept in flight starts at RAMIN
+// and doubles each time the reader catches up with half of it,
+// up to RAMAX; a read anywhere else turns read-ahead off until
+// sequential reading resumes.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, next, last, na;
+  uint addrs[RAMAX];
+
+  if(off != ip->ra_off){
+    ip->ra_off = off + n;
+    ip->ra_end = 0;
+    ip->ra_win = 0;
+    return;
+  }
+  ip->ra_off = off + n;
+  if(ip->size == 0)
+    return;
+
+  next = (off + n + BSIZE - 1) / BSIZE;  // first block not read yet
+  last = (ip->size - 1) / BSIZE;
+  if(ip->ra_end < next)
+    ip->ra_end = next;
+  if(ip->ra_win != 0 && ip->ra_end - next > ip->ra_win / 2)
+    return;  // still plenty in flight
+
+  ip->ra_win = ip->ra_win ? min(ip->ra_win * 2, RAMAX) : RAMIN;
+  na = 0;
+  for(bn = ip->ra_end; bn < next + ip->ra_win && bn <= last; bn++){
+    if((addrs[na] = bmap(ip, bn)) == 0)
+      break;
+    na++;
+  }
+  ip->ra_end += breadahead(ip->dev, addrs, na);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -479,6 +1306,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->flags & DI_INLINE){
+    if(either_copyout(user_dst, dst, ip->idata + off, n) == -1)
+      return -1;
+    return n;
+  }
+
+  readahead(ip, off, n);
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -505,27 +1340,74 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
+  int fresh, failed, run;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->flags & DI_INLINE){
+    if(off + n <= NINLINE){
+      // copy in first, so that a bad src changes nothing.
+      char data[NINLINE];
+      if(either_copyin(data, user_src, src, n) == -1)
+        return 0;
+      memmove(ip->idata + off, data, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(iexpand(ip) < 0)
+      return 0;
+  }
+
+  addr = 0;
+  run = 0;  // blocks after addr that bmapw() allocated with it
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+    // a new data block that will be overwritten whole
+    // need not be zeroed, nor read. past the end of the
+    // file, take the whole blocks still to come in one run.
+    if(run > 0){
+      addr++;
+      run--;
+      fresh = 1;
+    } else {
+      fresh = 0;
+      run = m == BSIZE && off >= ip->size ? (n - tot) / BSIZE : 1;
+      addr = bmapw(ip, off/BSIZE, m == BSIZE ? &fresh : 0, &run);
+      if(addr == 0)
+        break;
+      run--;
+    }
+    if(fresh)
+      bp = bgetblank(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
+    failed = either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1;
+    if(failed && !fresh){
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(failed)
+      memset(bp->data, 0, BSIZE); // it is in the file now
+    // file contents are written in place (ordered mode);
+    // directory blocks are metadata, and go through the log.
+    if(ip->type == T_FILE)
+      log_write_data(bp);
+    else
+      log_write(bp);
     brelse(bp);
+    if(failed)
+      break;
   }
+  // blocks of a run that a failed copy left unfilled.
+  for(; run > 0; run--)
+    bzero(ip->dev, ++addr, ip->type == T_FILE);
 
   if(off > ip->size)
     ip->size = off;
@@ -546,32 +1428,295 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+static struct dentry*
+dcache_set(uint dev, uint parent, char *name)
+{
+  uint h = (dev * 31 + parent) * 16777619;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return dcache.set[h % DC_SETS];
+}
+
+// Return the entry for name in directory parent, or 0.
+// Caller holds dcache.lock.
+static struct dentry*
+dcache_find(uint dev, uint parent, char *name)
+{
+  struct dentry *d;
+
+  d = dcache_set(dev, parent, name);
+  for(int i = 0; i < DC_WAYS; i++, d++)
+    if(d->parent == parent && d->dev == dev && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Record that name in directory parent is inum (0: absent).
+// Caller holds the directory's lock.
+static void
+dcache_enter(uint dev, uint parent, char *name, uint inum)
+{
+  struct dentry *d, *e;
+
+  if(strlen(name) > DC_NAMELEN)
+    return;
+  acquire(&dcache.lock);
+  if((d = dcache_find(dev, parent, name)) == 0){
+    d = e = dcache_set(dev, parent, name);
+    for(int i = 0; i < DC_WAYS; i++, e++){
+      if(e->parent == 0){
+        d = e;
+        break;
+      }
+      if(e->used < d->used)
+        d = e;
+    }
+    d->dev = dev;
+    d->parent = parent;
+    safestrcpy(d->name, name, sizeof(d->name));
+  }
+  d->inum = inum;
+  d->used = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Look name up in directory dp without locking dp.
+// Returns 1 and sets *ipp to its inode, or to 0 if dp is known
+// not to have it, or returns 0 if it is not in the cache.
+static int
+dcache_lookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  if(strlen(name) > DC_NAMELEN)
+    return 0;
+  acquire(&dcache.lock);
+  if((d = dcache_find(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  d->used = ++dcache.clock;
+  // iget() before releasing the lock, so an unlink cannot
+  // free the inode in between.
+  *ipp = d->inum ? iget(dp->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Forget the entries of directory dp, which is being freed.
+static void
+dcache_purge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = &dcache.set[0][0]; d < &dcache.set[DC_SETS][0]; d++)
+    if(d->parent == dp->inum && d->dev == dp->dev)
+      d->parent = 0;
+  release(&dcache.lock);
+}
+
+// Return the record at byte o of directory block bp,
+// checking that it lies within the block.
+static struct dirent*
+dirent_at(struct buf *bp, uint o)
+{
+  struct dirent *de = (struct dirent*)(bp->data + o);
+
+  if(de->reclen < DIRENTSIZE(0) || de->reclen % DIRALIGN ||
+     o + de->reclen > BSIZE ||
+     (de->inum && de->reclen < DIRENTSIZE(de->namelen)))
+    panic("dirent_at");
+  return de;
+}
+
+// Does record de hold name, which is len bytes long?
+static int
+direq(struct dirent *de, char *name, int len)
+{
+  return de->inum != 0 && de->namelen == len &&
+    memcmp(de->name, name, len) == 0;
+}
+
+// Read block off/BSIZE of directory dp.
+static struct buf*
+dirblock(struct inode *dp, uint off)
+{
+  return bread(dp->dev, bmap(dp, off / BSIZE));
+}
+
+// Directories bigger than DH_MIN bytes get an in-memory hash
+// index, built from their entries the first time they are searched
+// and kept up to date by dirlink() and dirunlink(), which make all
+// changes to directories. The index is not on disk, so any
+// directory can be indexed, and one without an index (small, too
+// big for the index, or memory was short) is scanned as before,
+// a block at a time.
+//
+// The index is an open-addressing table of record offsets, in
+// DIRALIGN units, + 1 (0 is empty, DH_TOMB deleted), spread over
+// whole pages so it can be as big as the directory needs.
+
+#define DH_MIN    (2*BSIZE)                   // index bigger directories
+#define DH_TPG    (PGSIZE / sizeof(ushort))    // table entries per page
+#define DH_MAXPG  32                          // pages of table at most
+#define DH_TOMB   0xffff
+
+struct dirhash {
+  int npg;          // table size is npg * DH_TPG, npg a power of 2
+  uint used;        // table entries that are not empty
+  uint free;        // no block below this offset has room
+  ushort *pg[DH_MAXPG];
+};
+
+static uint
+dhname(char *name, int len)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < len; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+static ushort*
+dhent(struct dirhash *dh, uint i)
+{
+  i &= dh->npg * DH_TPG - 1;
+  return &dh->pg[i / DH_TPG][i % DH_TPG];
+}
+
+// Throw away dp's index.
+static void
+dirhash_free(struct inode *dp)
+{
+  struct dirhash *dh = dp->dh;
+  int i;
+
+  if(dh == 0)
+    return;
+  for(i = 0; i < dh->npg; i++)
+    kfree(dh->pg[i]);
+  kfree(dh);
+  dp->dh = 0;
+}
+
+// Add the record at byte off, called name, to the index.
+static void
+dirhash_add(struct dirhash *dh, char *name, int len, uint off)
+{
+  ushort *e;
+  uint h;
+
+  for(h = dhname(name, len); ; h++){
+    e = dhent(dh, h);
+    if(*e == 0)
+      dh->used++;
+    if(*e == 0 || *e == DH_TOMB)
+      break;
+  }
+  *e = off / DIRALIGN + 1;
+}
+
+// Build an index for dp, if it is big enough to need one.
+// Caller holds dp->lock.
+static void
+dirhash_build(struct inode *dp)
+{
+  struct dirhash *dh;
+  struct dirent *de;
+  struct buf *bp;
+  uint nrec, off, o;
+  int npg;
+
+  // at most this many records fit.
+  nrec = dp->size / DIRENTSIZE(1);
+  if(dp->size <= DH_MIN || dp->size / DIRALIGN >= DH_TOMB - 1)
+    return;
+  for(npg = 1; npg * DH_TPG < 2 * nrec; npg *= 2)
+    ;
+  if(npg > DH_MAXPG || (dh = kalloc_cache()) == 0)
+    return;
+  memset(dh, 0, sizeof(*dh));
+  for(dh->npg = 0; dh->npg < npg; dh->npg++){
+    if((dh->pg[dh->npg] = kalloc_cache()) == 0){
+      dp->dh = dh;
+      dirhash_free(dp);
+      return;
+    }
+    memset(dh->pg[dh->npg], 0, PGSIZE);
+  }
+
+  dh->free = dp->size;
+  for(off = 0; off < dp->size; off += BSIZE){
+    bp = dirblock(dp, off);
+    for(o = 0; o < BSIZE; o += de->reclen){
+      de = dirent_at(bp, o);
+      if(de->inum)
+        dirhash_add(dh, de->name, de->namelen, off + o);
+      if(off < dh->free &&
+         de->reclen - (de->inum ? DIRENTSIZE(de->namelen) : 0) >= DIRENTSIZE(1))
+        dh->free = off;
+    }
+    brelse(bp);
+  }
+  dp->dh = dh;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint off, inum, h, o;
+  int len = strlen(name);
+  struct dirent *de;
+  struct buf *bp;
+  ushort *e;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dp->dh == 0)
+    dirhash_build(dp);
+  if(dp->dh){
+    for(h = dhname(name, len); *(e = dhent(dp->dh, h)) != 0; h++){
+      if(*e == DH_TOMB)
+        continue;
+      off = (*e - 1) * DIRALIGN;
+      bp = dirblock(dp, off);
+      de = dirent_at(bp, off % BSIZE);
+      if(direq(de, name, len))
+        goto found;
+      brelse(bp);
+    }
+    return 0;
+  }
+
+  for(off = 0; off < dp->size; off += BSIZE){
+    bp = dirblock(dp, off);
+    for(o = 0; o < BSIZE; o += de->reclen){
+      de = dirent_at(bp, o);
+      if(direq(de, name, len)){
+        off += o;
+        goto found;
+      }
     }
+    brelse(bp);
   }
 
   return 0;
+
+found:
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  inum = de->inum;
+  brelse(bp);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -579,9 +1724,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
+  uint off, o, used, addr;
+  int len = strlen(name), fresh;
+  struct dirent *de, *nde;
   struct inode *ip;
+  struct dirhash *dh;
+  struct buf *bp;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -589,22 +1737,101 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // Look for a record with room to spare: first fit.
+  dh = dp->dh;
+  for(off = dh ? dh->free : 0; off < dp->size; off += BSIZE){
+    bp = dirblock(dp, off);
+    for(o = 0; o < BSIZE; o += de->reclen){
+      de = dirent_at(bp, o);
+      used = de->inum ? DIRENTSIZE(de->namelen) : 0;
+      if(de->reclen - used >= DIRENTSIZE(len))
+        goto found;
+    }
+    brelse(bp);
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  // None: add a block, all free space.
+  fresh = 0;
+  if((addr = bmapw(dp, off / BSIZE, &fresh, 0)) == 0)
     return -1;
+  bp = fresh ? bgetblank(dp->dev, addr) : bread(dp->dev, addr);
+  o = used = 0;
+  // A fresh block holds whatever it last held; clear it all so no
+  // stale bytes end up in the directory.
+  memset(bp->data, 0, BSIZE);
+  de = (struct dirent*)bp->data;
+  de->reclen = BSIZE;
+  dp->size = off + BSIZE;
+  iupdate(dp);
+
+found:
+  if(used){
+    // split the record, taking the space after its name.
+    nde = (struct dirent*)((char*)de + used);
+    nde->reclen = de->reclen - used;
+    de->reclen = used;
+    de = nde;
+    o += used;
+  }
+  de->inum = inum;
+  de->namelen = len;
+  memmove(de->name, name, len);
+  log_write(bp);
+  brelse(bp);
+  dcache_enter(dp->dev, dp->inum, name, inum);
+
+  if(dh){
+    if((off + o) / DIRALIGN >= DH_TOMB - 1 ||
+       (dh->used + 1) * 2 > dh->npg * DH_TPG){
+      // full; the next dirlookup() builds a bigger one.
+      dirhash_free(dp);
+    } else {
+      dirhash_add(dh, name, len, off + o);
+      dh->free = off;
+    }
+  }
 
   return 0;
 }
 
+// Remove the entry for name, at byte offset off, from
+// the directory dp. Its space goes to the record before
+// it in the block, if there is one.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent *de, *prev;
+  struct buf *bp;
+  ushort *e;
+  uint h, o;
+
+  bp = dirblock(dp, off);
+  prev = 0;
+  for(o = 0; o < off % BSIZE; o += prev->reclen)
+    prev = dirent_at(bp, o);
+  de = dirent_at(bp, o);
+  if(o != off % BSIZE || de->inum == 0)
+    panic("dirunlink");
+  if(prev)
+    prev->reclen += de->reclen;
+  else
+    de->inum = 0;
+  log_write(bp);
+  brelse(bp);
+  dcache_enter(dp->dev, dp->inum, name, 0);
+
+  if(dp->dh){
+    for(h = dhname(name, strlen(name)); *(e = dhent(dp->dh, h)) != 0; h++){
+      if(*e == off / DIRALIGN + 1){
+        *e = DH_TOMB;
+        break;
+      }
+    }
+    if(off - off % BSIZE < dp->dh->free)
+      dp->dh->free = off - off % BSIZE;
+  }
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -633,12 +1860,10 @@ skipelem(char *path, char *name)
   while(*path != '/' && *path != 0)
     path++;
   len = path - s;
-  if(len >= DIRSIZ)
-    memmove(name, s, DIRSIZ);
-  else {
-    memmove(name, s, len);
-    name[len] = 0;
-  }
+  if(len > DIRSIZ)
+    len = DIRSIZ;
+  memmove(name, s, len);
+  name[len] = 0;
   while(*path == '/')
     path++;
   return path;
@@ -646,7 +1871,7 @@ skipelem(char *path, char *name)
 
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
-// path element into name, which must have room for DIRSIZ bytes.
+// path element into name, which must have room for DIRSIZ+1 bytes.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
 namex(char *path, int nameiparent, char *name)
@@ -659,6 +1884,14 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(!(nameiparent && *path == '\0') && dcache_lookup(ip, name, &next)){
+      // dcache entries are only made for directories.
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -669,7 +1902,9 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
+    next = dirlookup(ip, name, 0);
+    dcache_enter(ip->dev, ip->inum, name, next ? next->inum : 0);
+    if(next == 0){
       iunlockput(ip);
       return 0;
     }
@@ -686,7 +1921,7 @@ namex(char *path, int nameiparent, char *name)
 struct inode*
 namei(char *path)
 {
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
   return namex(path, 0, name);
 }
 
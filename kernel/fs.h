@@ -3,7 +3,14 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+
+// Block size. The Makefile builds mkfs, the kernel and user
+// programs with the same BSIZE, and mkfs records it in the
+// superblock. It must divide the page size, and be a multiple
+// of the 512-byte disk sector.
+#ifndef BSIZE
+#define BSIZE 4096
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -20,13 +27,38 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes)
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// The log is split into regions. Each starts with a header block
+// naming the home blocks of the n logged blocks that follow it.
+struct logheader {
+  uint seq;  // commit order
+  uint sum;  // checksum of the transaction
+  int n;
+  int block[];
+};
+
+// Most blocks one header block can name; more log blocks per
+// region than LOGHDRMAX+1 would go unused.
+#define LOGHDRMAX ((BSIZE - sizeof(struct logheader)) / sizeof(int))
+
+// addrs[] holds NDIRECT data block numbers, then the singly,
+// doubly and triply indirect blocks.
+#define NDIRECT 10
+#define NADDRS (NDIRECT+3)
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+
+// A small regular file keeps its contents in its inode, in idata,
+// which takes the place of addrs[], until it grows past NINLINE
+// bytes.
+#define NINLINE 112
+#define DI_INLINE 0x1   // dinode flags: contents are in idata
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +67,11 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // DI_*
+  union {
+    uint addrs[NADDRS];   // Data block addresses
+    char idata[NINLINE];  // or the data itself, if DI_INLINE
+  };
 };
 
 // Inodes per block.
@@ -50,11 +86,23 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
-// Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+// Directory is a file containing a sequence of variable-length
+// dirent records, packed into whole blocks. A record's reclen
+// takes it to the next record; the records in a block cover it
+// exactly, so none crosses a block boundary. A record with inum 0
+// is free space.
+#define DIRSIZ 255
 
 struct dirent {
   ushort inum;
-  char name[DIRSIZ];
+  ushort reclen;   // bytes from this record to the next
+  uchar namelen;
+  char name[];     // namelen bytes, not NUL-terminated
 };
 
+// Bytes a record with an n-byte name needs. Records start on
+// DIRALIGN-byte boundaries.
+#define DIRALIGN 4
+#define DIRENTSIZE(n) \
+  ((sizeof(struct dirent) + (n) + DIRALIGN-1) & ~(DIRALIGN-1))
+
@@ -7,11 +7,6 @@
 #include "defs.h"
 #include "grouplock.h"
 
-// Global group lock table
-static struct grouplock grouplocks[MAX_GROUPLOCKS];
-static struct spinlock grouplocks_table_lock;  // It ensures that one process doesn't try to destroy a locke
-                                              // while another is trying to check if it exists.
-
 // === Group operation implementation ===
 
 group_element_t group_add(group_element_t a, group_element_t b) {
@@ -44,18 +39,168 @@ static inline group_element_t atomic_group_add(volatile group_element_t *addr,
     return expected;
 }
 
+// === Lock allocation (slab) ===
+//
+// struct grouplock objects are carved out of kalloc()ed pages on
+// demand and recycled through a free list, so memory grows with the
+// number of live locks. Every object is given a slot when it is first
+// carved; the slot stays with the object across reuse, and its lock
+// word appears in user space at GLBASE + slot * PGSIZE.
+//
+// Each lock's word has a page of its own, so that a process can only
+// write the words of locks it has opened. The page is allocated when
+// the object is handed out and freed with it; processes that still
+// map a destroyed lock's page hold a reference of their own to it
+// (see grouplock_uvmmap()), so its slot can be reused safely.
+
+static struct {
+    struct spinlock lock;
+    struct grouplock *freelist;                // Free objects, linked through next
+    int nslots;                                // Slots handed out so far
+} glslab;
+
+static struct grouplock *gl_alloc(void) {
+    struct grouplock *gl;
+    struct grouplock_shared *sh;
+
+    if ((sh = kalloc()) == 0) {
+        return 0;
+    }
+    memset(sh, 0, PGSIZE);
+
+    acquire(&glslab.lock);
+    if (glslab.freelist == 0) {
+        // Carve a new page of objects; each takes the next slot
+        int n = PGSIZE / sizeof(struct grouplock);
+        if (n > NGROUPLOCK - glslab.nslots) {
+            n = NGROUPLOCK - glslab.nslots;
+        }
+        struct grouplock *objs = n > 0 ? kalloc() : 0;
+        if (objs == 0) {
+            release(&glslab.lock);
+            kfree(sh);
+            return 0;
+        }
+        memset(objs, 0, PGSIZE);
+        for (int i = 0; i < n; i++) {
+            objs[i].slot = glslab.nslots++;
+            objs[i].next = glslab.freelist;
+            glslab.freelist = &objs[i];
+        }
+    }
+    gl = glslab.freelist;
+    glslab.freelist = gl->next;
+    release(&glslab.lock);
+
+    gl->next = 0;
+    gl->sh = sh;
+    return gl;
+}
+
+static void gl_free(struct grouplock *gl) {
+    kfree(gl->sh);
+    gl->sh = 0;
+    acquire(&glslab.lock);
+    gl->next = glslab.freelist;
+    glslab.freelist = gl;
+    release(&glslab.lock);
+}
+
+// === Lock namespace (hash table) ===
+//
+// Locks are found by their 64-bit key in a hash table with one
+// spinlock per bucket. The bucket lock also protects the ref_count of
+// the locks hashed there and is the lock sleepers in grouplock_acquire()
+// sleep on, so an individual lock needs no spinlock of its own.
+
+static struct {
+    struct spinlock lock;
+    struct grouplock *head;
+} glhash[GL_NHASH];
+
+static struct spinlock glname_lock;  // Serializes lookup-or-create in grouplock_get()
+
+static inline uint gl_hash(uint64 key) {
+    // Fibonacci hashing spreads consecutive integer keys over the table
+    return (uint)((key * 0x9E3779B97F4A7C15UL) >> 32) % GL_NHASH;
+}
+
+// FNV-1a; named locks live in the upper half of the key space so
+// they never collide with small integer keys.
+static uint64 gl_namekey(char *name) {
+    uint64 h = 0xcbf29ce484222325UL;
+    for (int i = 0; i < GL_NAMELEN && name[i]; i++) {
+        h ^= (uchar)name[i];
+        h *= 0x100000001b3UL;
+    }
+    return h | GL_NAMED_KEY;
+}
+
+// Find the lock with this key and take a reference to it.
+// Caller holds the key's bucket lock.
+static struct grouplock *gl_lookup_locked(uint64 key) {
+    struct grouplock *gl;
+
+    for (gl = glhash[gl_hash(key)].head; gl; gl = gl->next) {
+        if (gl->key == key) {
+            gl->ref_count++;
+            break;
+        }
+    }
+    return gl;
+}
+
+static struct grouplock *gl_lookup(uint64 key) {
+    uint h = gl_hash(key);
+    struct grouplock *gl;
+
+    acquire(&glhash[h].lock);
+    gl = gl_lookup_locked(key);
+    release(&glhash[h].lock);
+    return gl;
+}
+
+// Drop a reference; the last one returns the object to the slab.
+static void gl_put(struct grouplock *gl) {
+    uint h = gl_hash(gl->key);
+    int free;
+
+    acquire(&glhash[h].lock);
+    free = (--gl->ref_count == 0);
+    release(&glhash[h].lock);
+    if (free) {
+        gl_free(gl);
+    }
+}
+
+// === Contention profiling ===
+
+// Count cycles in its log2 bucket.
+static void gl_hist(uint *hist, uint64 cycles) {
+    int b = 0;
+    
+    while (cycles > 1 && b < GL_NHIST - 1) {
+        cycles >>= 1;
+        b++;
+    }
+    hist[b]++;
+}
+
+// Record one hold time. Caller holds the bucket lock.
+static void gl_record_hold(struct grouplock *gl, uint64 hold) {
+    gl->prof.hold_samples++;
+    gl->prof.hold_total += hold;
+    gl_hist(gl->prof.hold_hist, hold);
+}
+
 // === System initialization ===
 
 void grouplock_init(void) {
-    initlock(&grouplocks_table_lock, "grouplocks_table");
-    
-    for (int i = 0; i < MAX_GROUPLOCKS; i++) {
-        grouplocks[i].group_id = -1;
-        grouplocks[i].state = GROUP_ELEM_0;
-        grouplocks[i].holder_pid = -1;
-        grouplocks[i].ref_count = 0;
-        grouplocks[i].acquire_time = 0;
-        initlock(&grouplocks[i].debug_lock, "grouplock_debug");
+    initlock(&glslab.lock, "grouplock_slab");
+    initlock(&glname_lock, "grouplock_name");
+    for (int i = 0; i < GL_NHASH; i++) {
+        initlock(&glhash[i].lock, "grouplock_hash");
+        glhash[i].head = 0;
     }
     
     printf("GroupLock: Initialized with Z/2Z group theory\n");
@@ -67,163 +212,373 @@ void grouplock_init(void) {
     }
 }
 
-// === Group lock management ===
+// === Shared lock pages ===
+
+// Map word page pa at slot i of pagetable. The mapping holds a
+// reference to the page, which grouplock_uvmunmap() drops. A page
+// left there by a destroyed lock that had the slot is replaced.
+static int grouplock_uvmmap(pagetable_t pagetable, int i, uint64 pa) {
+    uint64 va = GLBASE + i * PGSIZE;
+    uint64 old = walkaddr(pagetable, va);
 
-int grouplock_create(int group_id, char *name) {
-    if (group_id < 0 || group_id >= MAX_GROUPLOCKS) {
+    if (old == pa) {
+        return 0;
+    }
+    if (old != 0) {
+        uvmunmap(pagetable, va, 1, 1);
+    }
+    if (mappages(pagetable, va, PGSIZE, pa, PTE_R | PTE_W | PTE_U) < 0) {
         return -1;
     }
-    
-    acquire(&grouplocks_table_lock);
-    
-    if (grouplocks[group_id].group_id != -1) {
-        release(&grouplocks_table_lock);
-        return -2; // Lock already exists
+    inc_ref((void *)pa);
+    return 0;
+}
+
+// Give a fork child the parent's mappings of the shared word pages.
+// Only slots handed out so far can be mapped; nslots never shrinks.
+int grouplock_uvmcopy(pagetable_t old, pagetable_t new) {
+    uint64 pa;
+
+    for (int i = 0; i < glslab.nslots; i++) {
+        if ((pa = walkaddr(old, GLBASE + i * PGSIZE)) != 0 &&
+            grouplock_uvmmap(new, i, pa) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Drop the shared word pages from a page table that is being freed,
+// and with them the references the mappings hold.
+void grouplock_uvmunmap(pagetable_t pagetable) {
+    for (int i = 0; i < glslab.nslots; i++) {
+        if (walkaddr(pagetable, GLBASE + i * PGSIZE) != 0) {
+            uvmunmap(pagetable, GLBASE + i * PGSIZE, 1, 1);
+        }
+    }
+}
+
+// Map the page holding key's lock word into the calling process and
+// return the user address of the word, or 0 on failure. The page
+// holds no other lock's word.
+uint64 grouplock_open(uint64 key) {
+    struct grouplock *gl = gl_lookup(key);
+    uint64 va = 0;
+
+    if (gl == 0) {
+        return 0;
+    }
+    if (grouplock_uvmmap(myproc()->pagetable, gl->slot, (uint64)gl->sh) == 0) {
+        va = GLBASE + gl->slot * PGSIZE;
+    }
+    gl_put(gl);
+    return va;
+}
+
+// === Group lock management ===
+
+// Insert a fresh lock under key. Returns -2 if the key is taken.
+static int gl_insert(uint64 key, char *name) {
+    struct grouplock *gl, *p;
+    uint h = gl_hash(key);
+
+    if ((gl = gl_alloc()) == 0) {
+        printf("GroupLock: out of locks\n");
+        return -1;
     }
     
-    grouplocks[group_id].group_id = group_id;
-    grouplocks[group_id].state = GROUP_ELEM_0; // Initially identity element
-    grouplocks[group_id].holder_pid = -1;
-    grouplocks[group_id].ref_count = 1;  // create and ref at the same time
-    grouplocks[group_id].acquire_time = 0;
+    gl->key = key;
+    gl->sh->state = GROUP_ELEM_0; // Initially identity element
+    gl->sh->holder_pid = -1;
+    gl->sh->waiters = 0;
+    gl->sh->key = key;
+    gl->sh->acquires = 0;
+    gl->sh->acquired_at = 0;
+    gl->ref_count = 1;  // the namespace's reference, dropped by destroy
+    gl->acquire_time = 0;
+    memset(&gl->prof, 0, sizeof(gl->prof));
+#ifdef LOCKDEP
+    gl->ldclass = 0;
+#endif
     
     // Safely copy lock name
     int len = 0;
-    while (len < 15 && name[len] != '\0') {
-        grouplocks[group_id].name[len] = name[len];
+    while (len < GL_NAMELEN - 1 && name[len] != '\0') {
+        gl->name[len] = name[len];
         len++;
     }
-    grouplocks[group_id].name[len] = '\0';
-    
-    release(&grouplocks_table_lock);
-    
-    printf("GroupLock: Created lock %d (%s) with identity element\n", group_id, name);
+    gl->name[len] = '\0';
+    
+    acquire(&glhash[h].lock);
+    for (p = glhash[h].head; p; p = p->next) {
+        if (p->key == key) {
+            release(&glhash[h].lock);
+            gl_free(gl);
+            return -2; // Lock already exists
+        }
+    }
+    gl->next = glhash[h].head;
+    glhash[h].head = gl;
+    release(&glhash[h].lock);
     return 0;
 }
 
-// === Core lock operation: group theory based acquire ===
+int grouplock_create(uint64 key, char *name) {
+    int r;
 
-int grouplock_acquire(int group_id) {
-    if (group_id < 0 || group_id >= MAX_GROUPLOCKS) {
-        return -1;
+    if ((key & GL_NAMED_KEY) != 0) {
+        return -1; // Reserved for grouplock_get()
+    }
+    if ((r = gl_insert(key, name)) < 0) {
+        return r;
     }
     
+    printf("GroupLock: Created lock %ld (%s) with identity element\n", key, name);
+    return 0;
+}
+
+// Look up the lock called name, creating it if needed, and return
+// its key. Returns 0 on failure (named keys are never 0).
+uint64 grouplock_get(char *name) {
+    uint64 key = gl_namekey(name);
+    struct grouplock *gl;
+    int r;
+
+    acquire(&glname_lock);
+    if ((gl = gl_lookup(key)) != 0) {
+        release(&glname_lock);
+        r = strncmp(gl->name, name, GL_NAMELEN - 1);
+        gl_put(gl);
+        return r == 0 ? key : 0; // 0: a different name hashed to this key
+    }
+    r = gl_insert(key, name);
+    release(&glname_lock);
+    return r == 0 ? key : 0;
+}
+
+// === Core lock operation: group theory based acquire ===
+
+// Slow path of acquire. User space only gets here after its own
+// 0 + 1 = 1 CAS failed, so register as a waiter and sleep until a
+// release finds waiters != 0 and wakes us.
+int grouplock_acquire(uint64 key) {
     struct proc *p = myproc();
-    
-    // Check if lock exists(check whether lock has been created or not)
-    acquire(&grouplocks_table_lock);
-    if (grouplocks[group_id].group_id == -1) {
-        release(&grouplocks_table_lock);
+    struct grouplock *gl;
+    uint h = gl_hash(key);
+    uint64 start = r_time();
+    int contended = 0;
+    
+    // Check if lock exists(check whether lock has been created or not).
+    // Look it up under the bucket lock and keep holding that, so that
+    // grouplock_destroy() cannot take it out of the namespace before
+    // we are counted in waiters.
+    acquire(&glhash[h].lock);
+    if ((gl = gl_lookup_locked(key)) == 0) {
+        release(&glhash[h].lock);
         return -2;
     }
-    release(&grouplocks_table_lock);
     
-    // Disable interrupts to avoid deadlock
-    push_off();
+    printf("GroupLock: Process %d attempting to acquire lock %ld\n", p->pid, key);
     
-    printf("GroupLock: Process %d attempting to acquire lock %d\n", p->pid, group_id);
+    // Announce ourselves before trying the CAS, so that a releaser
+    // either sees waiters != 0 or has already made the state 0.
+    __sync_fetch_and_add(&gl->sh->waiters, 1);
     
     // Use atomic CAS for group operation: can acquire lock only when current state is identity
-    while (1) {
-    group_element_t expected = GROUP_ELEM_0;  // Expect unlocked state (identity)
-    group_element_t desired = GROUP_ELEM_1;   // Want to set to locked state
-        
     // Atomic compare-and-swap: atomic implementation of group operation 0 + 1 = 1
-        if (__sync_bool_compare_and_swap(&grouplocks[group_id].state, expected, desired)) {
-            // Successfully acquired lock: applied group operation e + a = a
-            grouplocks[group_id].holder_pid = p->pid;
-            grouplocks[group_id].acquire_time = ticks;
-            
-            // Memory barrier ensures critical section operations are not reordered before lock acquisition
-            __sync_synchronize();
-            
-            printf("GroupLock: Process %d acquired lock %d using group operation (0 + 1 = 1)\n",
-                   p->pid, group_id);
-            
-            pop_off();
-            return 0;
+    while (!__sync_bool_compare_and_swap(&gl->sh->state, GROUP_ELEM_0, GROUP_ELEM_1)) {
+        if (killed(p)) {
+            __sync_fetch_and_sub(&gl->sh->waiters, 1);
+            release(&glhash[h].lock);
+            gl_put(gl);
+            return -4;
         }
-        
-    // If acquisition fails, yield CPU (spin wait)
-        pop_off();
-        yield();
-        push_off(); // To ensure next iteration has interrupts off
+        // Lock is held: sleep until the holder releases it
+        contended = 1;
+        sleep(gl, &glhash[h].lock);
+    }
+    
+    __sync_fetch_and_sub(&gl->sh->waiters, 1);
+    
+    // Successfully acquired lock: applied group operation e + a = a
+    gl->sh->holder_pid = p->pid;
+    gl->sh->acquired_at = r_time();
+    gl->sh->acquires++;
+    gl->acquire_time = ticks;
+    if (contended) {
+        gl->prof.contended++;
+        gl->prof.wait_total += gl->sh->acquired_at - start;
+        gl_hist(gl->prof.wait_hist, gl->sh->acquired_at - start);
     }
+    
+    release(&glhash[h].lock);
+    
+    // Memory barrier ensures critical section operations are not reordered before lock acquisition
+    __sync_synchronize();
+    
+#ifdef LOCKDEP
+    // Tracked by the holder pid word, which the user-space release
+    // path clears without telling the kernel.
+    lockdep_acquire((void *)&gl->sh->holder_pid, gl->name, &gl->ldclass, LD_GROUP);
+#endif
+    
+    printf("GroupLock: Process %d acquired lock %ld using group operation (0 + 1 = 1)\n",
+           p->pid, key);
+    
+    gl_put(gl);
+    return 0;
 }
 
 // === Core lock operation: group theory based release ===
 
-int grouplock_release(int group_id) {
-    if (group_id < 0 || group_id >= MAX_GROUPLOCKS) {
-        return -1;
-    }
-    
+int grouplock_release(uint64 key) {
     struct proc *p = myproc();
+    struct grouplock *gl;
+    uint h = gl_hash(key);
     
     // Check if lock exists(check whether lock has been created or not)
-    acquire(&grouplocks_table_lock);
-    if (grouplocks[group_id].group_id == -1) {
-        release(&grouplocks_table_lock);
+    if ((gl = gl_lookup(key)) == 0) {
         return -2;
     }
-    release(&grouplocks_table_lock);
     
-    // Verify if current process is lock holder
-    if (grouplocks[group_id].holder_pid != p->pid) {
+    // Verify if current process is lock holder. A lock taken on the
+    // user-space fast path (holder_pid 0) has no known holder, so it
+    // can only be released there, by a process that opened it.
+    if (gl->sh->state != GROUP_ELEM_1 || gl->sh->holder_pid != p->pid) {
+        gl_put(gl);
         return -3;
     }
     
-    push_off();
+#ifdef LOCKDEP
+    lockdep_release((void *)&gl->sh->holder_pid, LD_GROUP);
+#endif
     
     // Clear holder information
-    grouplocks[group_id].holder_pid = -1;
-    grouplocks[group_id].acquire_time = 0;
+    acquire(&glhash[h].lock);
+    gl_record_hold(gl, r_time() - gl->sh->acquired_at);
+    release(&glhash[h].lock);
+    gl->sh->holder_pid = -1;
+    gl->acquire_time = 0;
     
     // Memory barrier ensures critical section operations are completed before releasing lock
     __sync_synchronize();
     
-    printf("GroupLock: Process %d releasing lock %d using inverse operation\n", p->pid, group_id);
+    printf("GroupLock: Process %d releasing lock %ld using inverse operation\n", p->pid, key);
     
     // Atomically apply group inverse operation: 1 + 1 = 0 (mod 2)
-    group_element_t old_state = atomic_group_add(&grouplocks[group_id].state, GROUP_ELEM_1);
+    group_element_t old_state = atomic_group_add(&gl->sh->state, GROUP_ELEM_1);
     
     if (old_state != GROUP_ELEM_1) {
     printf("GroupLock: WARNING - Released lock from unexpected state %d\n", old_state);
     } else {
-        printf("GroupLock: Process %d released lock %d using group operation (1 + 1 = 0)\n",
-               p->pid, group_id);
+        printf("GroupLock: Process %d released lock %ld using group operation (1 + 1 = 0)\n",
+               p->pid, key);
     }
     
-    pop_off();
+    if (gl->sh->waiters != 0) {
+        acquire(&glhash[h].lock);
+        wakeup(gl);
+        release(&glhash[h].lock);
+    }
+    gl_put(gl);
     return 0;
 }
 
-int grouplock_destroy(int group_id) {
-    if (group_id < 0 || group_id >= MAX_GROUPLOCKS) {
-        return -1;
+// Wake the processes sleeping in grouplock_acquire().
+// Called by the user-space release path after it has made the state
+// 0 and seen waiters != 0; hold is how long it held the lock.
+int grouplock_wake(uint64 key, uint64 hold) {
+    struct grouplock *gl;
+    uint h = gl_hash(key);
+    
+    if ((gl = gl_lookup(key)) == 0) {
+        return -2;
     }
     
-    acquire(&grouplocks_table_lock);
+    acquire(&glhash[h].lock);
+    gl_record_hold(gl, hold);
+    wakeup(gl);
+    release(&glhash[h].lock);
+    
+    gl_put(gl);
+    return 0;
+}
+
+// Remove the lock from the namespace. The object is freed once
+// the last in-flight operation drops its reference.
+int grouplock_destroy(uint64 key) {
+    struct grouplock *gl, **pp;
+    uint h = gl_hash(key);
+    
+    acquire(&glhash[h].lock);
     
-    if (grouplocks[group_id].group_id == -1) {
-        release(&grouplocks_table_lock);
+    for (pp = &glhash[h].head; (gl = *pp) != 0; pp = &gl->next) {
+        if (gl->key == key) {
+            break;
+        }
+    }
+    if (gl == 0) {
+        release(&glhash[h].lock);
         return -2;
     }
     
-    if (grouplocks[group_id].state != GROUP_ELEM_0) {
-        release(&grouplocks_table_lock);
+    if (gl->sh->state != GROUP_ELEM_0 || gl->sh->waiters != 0) {
+        release(&glhash[h].lock);
         return -3; // Lock is currently in use
     }
     
-    grouplocks[group_id].group_id = -1;
-    grouplocks[group_id].ref_count = 0;
+    *pp = gl->next;
+    gl->next = 0;
     
-    printf("GroupLock: Destroyed lock %d (returned to identity)\n", group_id);
+    printf("GroupLock: Destroyed lock %ld (returned to identity)\n", key);
     
-    release(&grouplocks_table_lock);
+    release(&glhash[h].lock);
+    gl_put(gl);
     return 0;
 }
 
+// Copy the contention profile of up to max live locks to the user
+// array of struct grouplock_stat at addr. Returns the number copied.
+// Each lock is snapshotted under its bucket lock, which is released
+// before copyout(): that may have to copy a COW page, so it must not
+// run holding a spinlock.
+int grouplock_stats(uint64 addr, int max) {
+    struct grouplock_stat st;
+    struct grouplock *gl;
+    int n = 0;
+    
+    for (int h = 0; h < GL_NHASH && n < max; h++) {
+        // The i-th lock in the chain, for as long as there is one
+        for (int i = 0; n < max; i++) {
+            acquire(&glhash[h].lock);
+            gl = glhash[h].head;
+            for (int j = 0; gl && j < i; j++) {
+                gl = gl->next;
+            }
+            if (gl) {
+                st.key = gl->key;
+                safestrcpy(st.name, gl->name, sizeof(st.name));
+                st.acquires = gl->sh->acquires;
+                st.contended = gl->prof.contended;
+                st.hold_samples = gl->prof.hold_samples;
+                st.wait_total = gl->prof.wait_total;
+                st.hold_total = gl->prof.hold_total;
+                memmove(st.wait_hist, gl->prof.wait_hist, sizeof(st.wait_hist));
+                memmove(st.hold_hist, gl->prof.hold_hist, sizeof(st.hold_hist));
+            }
+            release(&glhash[h].lock);
+            if (gl == 0) {
+                break;
+            }
+            if (copyout(myproc()->pagetable, addr + n * sizeof(st), (char *)&st, sizeof(st)) < 0) {
+                return -1;
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
 // === Mathematical property verification ===
 
 int verify_group_properties(void) {
@@ -365,29 +720,39 @@ int verify_atomic_group_operations(void) {
 // === Debug functions ===
 // Print grouplock info like name, state, holder PID, acquire time, ref count to debug
 
-void grouplock_debug_info(int group_id) {
-    if (group_id < 0 || group_id >= MAX_GROUPLOCKS) {
-        printf("GroupLock: Invalid group_id %d\n", group_id);
+void grouplock_debug_info(uint64 key) {
+    struct grouplock *gl;
+    uint h = gl_hash(key);
+    
+    if ((gl = gl_lookup(key)) == 0) {
+        printf("GroupLock: No lock with key %ld\n", key);
         return;
     }
     
-    acquire(&grouplocks[group_id].debug_lock);
+    acquire(&glhash[h].lock);
     
-    printf("=== GroupLock Debug Info for lock %d ===\n", group_id);
-    printf("Name: %s\n", grouplocks[group_id].name);
+    printf("=== GroupLock Debug Info for lock %ld ===\n", key);
+    printf("Name: %s\n", gl->name);
     printf("Group Element State: %d (%s)\n", 
-           grouplocks[group_id].state,
-           grouplocks[group_id].state == GROUP_ELEM_0 ? "IDENTITY/UNLOCKED" : "LOCKED");
-    printf("Holder PID: %d\n", grouplocks[group_id].holder_pid);
-    printf("Acquire Time: %ld ticks\n", grouplocks[group_id].acquire_time);
-    printf("Reference Count: %d\n", grouplocks[group_id].ref_count);
+           gl->sh->state,
+           gl->sh->state == GROUP_ELEM_0 ? "IDENTITY/UNLOCKED" : "LOCKED");
+    if (gl->sh->state != GROUP_ELEM_0 && gl->sh->holder_pid == 0) {
+        printf("Holder PID: unknown (user-space fast path)\n");
+    } else {
+        printf("Holder PID: %d\n", gl->sh->holder_pid);
+    }
+    printf("Waiters: %d\n", gl->sh->waiters);
+    printf("Acquire Time: %ld ticks\n", gl->acquire_time);
+    printf("Reference Count: %d\n", gl->ref_count - 1);  // not counting our own
+    printf("Acquisitions: %d (%d contended)\n", gl->sh->acquires, gl->prof.contended);
     
     // Mathematical state analysis
     printf("Mathematical Analysis:\n");
-    printf("  Current element: %d ∈ Z/2Z\n", grouplocks[group_id].state);
-    printf("  Inverse element: %d\n", group_inverse(grouplocks[group_id].state));
+    printf("  Current element: %d ∈ Z/2Z\n", gl->sh->state);
+    printf("  Inverse element: %d\n", group_inverse(gl->sh->state));
     printf("  Distance to identity: %d\n", 
-           grouplocks[group_id].state == GROUP_ELEM_0 ? 0 : 1);
+           gl->sh->state == GROUP_ELEM_0 ? 0 : 1);
     
-    release(&grouplocks[group_id].debug_lock);
+    release(&glhash[h].lock);
+    gl_put(gl);
 }
@@ -4,25 +4,36 @@
 #include "types.h"
 #include "param.h"
 #include "spinlock.h"
+#include "grouplock_shared.h"
+
+#define GL_NHASH 1024                // Hash buckets in the lock namespace
+#define GL_NAMELEN 16                // Lock name length, including the NUL
+#define GL_NAMED_KEY (1UL << 63)     // Set in keys made by grouplock_get()
+
+// Per-lock contention profile, protected by the hash bucket lock.
+// See struct grouplock_stat for what is sampled when.
+struct glprof {
+    uint contended;                  // Acquisitions that found the lock held
+    uint hold_samples;               // Number of hold times recorded
+    uint64 wait_total;               // Sum of wait times (time-CSR cycles)
+    uint64 hold_total;               // Sum of sampled hold times
+    uint wait_hist[GL_NHIST];        // log2 histogram of wait times
+    uint hold_hist[GL_NHIST];        // log2 histogram of hold times
+};
 
-// Maximum number of group locks
-#define MAX_GROUPLOCKS 64
-
-// Z/2Z group element type
-typedef enum {
-    GROUP_ELEM_0 = 0,    // Unlocked state, identity element
-    GROUP_ELEM_1 = 1     // Locked state
-} group_element_t;
-
-// Group lock structure
+// Group lock structure, allocated from the grouplock slab
 struct grouplock {
-    volatile group_element_t state;  // Current group element state
-    int group_id;                    // Group lock ID
-    int holder_pid;                  // Process ID holding the lock
-    char name[16];                   // Lock name
-    int ref_count;                   // Reference count
+    uint64 key;                      // Group lock key
+    struct grouplock_shared *sh;     // Lock word, in a page of its own
+    struct grouplock *next;          // Hash chain, or slab free list
+    int slot;                        // sh appears at GLBASE + slot * PGSIZE
+    int ref_count;                   // Namespace + in-flight references
+    char name[GL_NAMELEN];           // Lock name
     uint64 acquire_time;             // Lock acquisition timestamp
-    struct spinlock debug_lock;      // Lock protecting debug information
+    struct glprof prof;              // Contention profile
+#ifdef LOCKDEP
+    int ldclass;                     // Lockdep class + 1, or 0
+#endif
 };
 
 // Group operation functions
@@ -32,11 +43,15 @@ int group_is_identity(group_element_t a);
 
 // Group lock operation functions
 void grouplock_init(void);
-int grouplock_create(int group_id, char *name);
-int grouplock_acquire(int group_id);
-int grouplock_release(int group_id);
-int grouplock_destroy(int group_id);
-void grouplock_debug_info(int group_id);
+int grouplock_create(uint64 key, char *name);
+uint64 grouplock_get(char *name);
+int grouplock_acquire(uint64 key);
+int grouplock_release(uint64 key);
+int grouplock_destroy(uint64 key);
+uint64 grouplock_open(uint64 key);
+int grouplock_wake(uint64 key, uint64 hold);
+int grouplock_stats(uint64 addr, int max);
+void grouplock_debug_info(uint64 key);
 
 // Mathematical verification functions
 int verify_group_properties(void);
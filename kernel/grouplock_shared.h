@@ -0,0 +1,53 @@
+#ifndef GROUPLOCK_SHARED_H
+#define GROUPLOCK_SHARED_H
+
+// Grouplock definitions shared by the kernel and user programs.
+
+// Z/2Z group element type
+typedef enum {
+    GROUP_ELEM_0 = 0,    // Unlocked state, identity element
+    GROUP_ELEM_1 = 1     // Locked state
+} group_element_t;
+
+// Lock word shared with user space.
+// Each lives at the start of a page of its own that grouplock_open()
+// maps into the caller below GLBASE, so the uncontended 0 + 1 = 1
+// and 1 + 1 = 0 transitions are a single CAS in user space, and a
+// process can only write the words of locks it has opened. The
+// kernel is only entered to sleep while the lock is held or to wake
+// sleepers.
+struct grouplock_shared {
+    volatile group_element_t state;  // Current group element state
+    volatile int holder_pid;         // Holder PID, 0 if taken in user space
+    volatile int waiters;            // Processes sleeping in the kernel
+    uint acquires;                   // Acquisitions, counted by each new holder
+    uint64 key;                      // Group lock key (for the slow path)
+    uint64 acquired_at;              // time CSR when the holder got the lock
+};
+
+// Maximum number of group locks, one per shared page.
+// Users need param.h.
+#define NGROUPLOCK NGLPAGE
+
+// Contention profile buckets: bucket i counts times in
+// [2^i, 2^(i+1)) time-CSR cycles, the last one everything longer.
+#define GL_NHIST 24
+
+// One lock's contention profile, as returned by grouplock_stats().
+// Wait times cover every acquisition that had to sleep. Hold times
+// are sampled whenever a release enters the kernel: always for the
+// grouplock_release() syscall, and on the fast path when there are
+// waiters, i.e. for exactly the holds somebody was waiting behind.
+struct grouplock_stat {
+    uint64 key;
+    char name[16];
+    uint acquires;                   // All acquisitions, fast path included
+    uint contended;                  // Acquisitions that found the lock held
+    uint hold_samples;               // Number of hold times recorded
+    uint64 wait_total;               // Sum of wait times (cycles)
+    uint64 hold_total;               // Sum of sampled hold times (cycles)
+    uint wait_hist[GL_NHIST];
+    uint hold_hist[GL_NHIST];
+};
+
+#endif
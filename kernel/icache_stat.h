@@ -0,0 +1,16 @@
+#ifndef ICACHE_STAT_H
+#define ICACHE_STAT_H
+
+// Inode table statistics, as returned by the icachestat() system
+// call. Counts are since boot; sizes are in inodes.
+struct icachestat {
+  uint64 hits;       // iget()s that found the inode in the table
+  uint64 misses;     // iget()s that had to find an entry for it
+  uint64 evictions;  // misses that recycled another inode's entry
+  uint64 grows;      // pages of memory added to the table
+  uint ninode;       // entries in the table now
+  uint max;          // the table grows up to this many entries
+  uint min;          // and starts with this many
+};
+
+#endif
@@ -12,6 +12,8 @@
 void freerange(void *pa_start, void *pa_end);
 void kfree_huge(void *pa);
 
+#define KRECLAIM 16  // pages to ask the buffer cache for when out of memory
+
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
@@ -23,6 +25,7 @@ struct {
   struct spinlock lock;
   struct run *freelist;
   struct run *huge_freelist; // Free list for 2MB pages
+  uint64 nfree;              // Free 4KB pages, including those in 2MB pages
   uint ref_counts[(PHYSTOP - KERNBASE) / PGSIZE];
 } kmem;
 
@@ -114,9 +117,36 @@ kfree(void *pa)
   acquire(&kmem.lock);
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   release(&kmem.lock);
 }
 
+// Take a page off the free list, splitting a 2MB page into
+// 4KB pages if the list is empty. Caller holds kmem.lock.
+static struct run *
+kpop(void)
+{
+  struct run *r, *h;
+  int i;
+
+  if(kmem.freelist == 0 && (h = kmem.huge_freelist) != 0){
+    kmem.huge_freelist = h->next;
+    // The sub-pages' ref counts are already 0.
+    for(i = 511; i >= 0; i--){
+      r = (struct run*)((char*)h + i*PGSIZE);
+      r->next = kmem.freelist;
+      kmem.freelist = r;
+    }
+  }
+  r = kmem.freelist;
+  if(r){
+    kmem.freelist = r->next;
+    kmem.ref_counts[((uint64)r - KERNBASE) / PGSIZE] = 1;
+    kmem.nfree--;
+  }
+  return r;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
@@ -126,11 +156,32 @@ kalloc(void)
   struct run *r;
 
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r){
-    kmem.freelist = r->next;
-    kmem.ref_counts[((uint64)r - KERNBASE) / PGSIZE] = 1;
+  r = kpop();
+  release(&kmem.lock);
+
+  // Out of memory: have the buffer cache give some back.
+  if(r == 0 && bcache_reclaim(KRECLAIM) > 0){
+    acquire(&kmem.lock);
+    r = kpop();
+    release(&kmem.lock);
   }
+
+  if(r)
+    memset((char*)r, 5, PGSIZE); // fill with junk
+  return (void*)r;
+}
+
+// Allocate a page for a cache, which can do without it: fail
+// rather than dip into the last KRESERVE free pages, and never
+// ask the buffer cache to shrink.
+void *
+kalloc_cache(void)
+{
+  struct run *r = 0;
+
+  acquire(&kmem.lock);
+  if(kmem.nfree > KRESERVE)
+    r = kpop();
   release(&kmem.lock);
 
   if(r)
@@ -148,6 +199,7 @@ kalloc_huge(void)
   r = kmem.huge_freelist;
   if(r){
     kmem.huge_freelist = r->next;
+    kmem.nfree -= 512;
     // The ref_counts are already set to 1 by freerange
   }
   release(&kmem.lock);
@@ -186,6 +238,7 @@ kfree_huge(void *pa)
   acquire(&kmem.lock);
   r->next = kmem.huge_freelist;
   kmem.huge_freelist = r;
+  kmem.nfree += 512;
   release(&kmem.lock);
 }
 
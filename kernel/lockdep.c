@@ -0,0 +1,292 @@
+// Lock dependency validator.
+//
+// Compiled in with make LOCKDEP=1. Every lock belongs to a class,
+// identified by the lock's name: all the buffer sleeplocks are one
+// class, all the p->locks another. When a lock of class B is
+// acquired while one of class A is held, lockdep records the edge
+// A -> B. If B could already reach A through recorded edges, two
+// code paths take the same locks in opposite orders and can
+// deadlock, even if they have not happened to do so yet; lockdep
+// prints the cycle the first time it sees the edge that closes it.
+//
+// Spinlocks are kept on a per-CPU held stack, sleeplocks and group
+// locks on a per-process one. Taking a lock of a class that is
+// already held is not reported: inodes and buffers nest by design.
+
+#ifdef LOCKDEP
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define LD_NCLASS  256        // max lock classes
+#define LD_NAMELEN 16         // class name length, including the NUL
+#define LD_MAXPATH 8          // longest cycle printed in full
+
+static struct {
+  // lockdep cannot use a struct spinlock to protect itself,
+  // so it has a bare test-and-set lock.
+  uint locked;
+  int nclass;
+  char name[LD_NCLASS][LD_NAMELEN];
+  // Bit b of edge[a] is set once b has been acquired holding a.
+  // Bits are only ever set, so they may be tested without locked.
+  uint64 edge[LD_NCLASS][LD_NCLASS/64];
+  short prev[LD_NCLASS];      // BFS state for ld_path()
+  short queue[LD_NCLASS];
+  int warned;                 // already complained about running out
+} ld;
+
+// A cycle found while holding ld.locked, printed after releasing it.
+struct ldreport {
+  int held;                   // class already held
+  int class;                  // class being acquired
+  int n;                      // classes on the old path class ->* held
+  short path[LD_MAXPATH];
+};
+
+static void
+ld_lock(void)
+{
+  while(__sync_lock_test_and_set(&ld.locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+static void
+ld_unlock(void)
+{
+  __sync_synchronize();
+  __sync_lock_release(&ld.locked);
+}
+
+static int
+ld_hasedge(int a, int b)
+{
+  return (*(volatile uint64 *)&ld.edge[a][b/64] >> (b%64)) & 1;
+}
+
+// Return the class called name, adding it if it is new.
+// *cache remembers the answer in the lock itself.
+// Caller holds ld.locked.
+static int
+ld_class(char *name, int *cache)
+{
+  int c;
+
+  if(*cache > 0)
+    return *cache - 1;
+  for(c = 0; c < ld.nclass; c++)
+    if(strncmp(ld.name[c], name, LD_NAMELEN - 1) == 0)
+      goto found;
+  if(ld.nclass == LD_NCLASS)
+    return -1;
+  c = ld.nclass++;
+  safestrcpy(ld.name[c], name, LD_NAMELEN);
+found:
+  *cache = c + 1;
+  return c;
+}
+
+// Breadth-first search for a path from -> ... -> to among the
+// recorded edges. Returns the number of classes on the shortest
+// path, or 0 if there is none; the first LD_MAXPATH are stored in
+// path. Caller holds ld.locked.
+static int
+ld_path(int from, int to, short *path)
+{
+  int head, tail, a, b, n;
+
+  for(a = 0; a < ld.nclass; a++)
+    ld.prev[a] = -1;
+  ld.prev[from] = from;
+  head = tail = 0;
+  ld.queue[tail++] = from;
+  while(head < tail){
+    a = ld.queue[head++];
+    for(b = 0; b < ld.nclass; b++){
+      if(ld.prev[b] >= 0 || !ld_hasedge(a, b))
+        continue;
+      ld.prev[b] = a;
+      if(b == to)
+        goto found;
+      ld.queue[tail++] = b;
+    }
+  }
+  return 0;
+
+found:
+  n = 1;
+  for(b = to; b != from; b = ld.prev[b])
+    n++;
+  // Walk back from to, filling in the slots that fit.
+  a = n;
+  for(b = to; ; b = ld.prev[b]){
+    if(--a < LD_MAXPATH)
+      path[a] = b;
+    if(b == from)
+      break;
+  }
+  return n;
+}
+
+// Record held -> class. Caller holds ld.locked.
+static void
+ld_addedge(int held, int class, struct ldreport *r)
+{
+  if(held == class || ld_hasedge(held, class))
+    return;
+  if(r->n == 0 && (r->n = ld_path(class, held, r->path)) != 0){
+    r->held = held;
+    r->class = class;
+  }
+  ld.edge[held][class/64] |= 1UL << (class%64);
+}
+
+static void
+ld_print(struct ldreport *r)
+{
+  int i;
+
+  printf("lockdep: possible deadlock: acquiring %s while holding %s,\n",
+         ld.name[r->class], ld.name[r->held]);
+  printf("lockdep: but the reverse order was seen before:\n");
+  for(i = 0; i < r->n && i < LD_MAXPATH; i++)
+    printf("lockdep:   %s%s\n", i ? "-> " : "", ld.name[r->path[i]]);
+  if(r->n > LD_MAXPATH)
+    printf("lockdep:   -> ... (%d more)\n", r->n - LD_MAXPATH);
+}
+
+// Drop group locks that user space has released on its fast path,
+// which never enters the kernel: their holder pid word no longer
+// names this process.
+static void
+ld_prune(struct proc *p)
+{
+  int i, j;
+
+  for(i = j = 0; i < p->ldnheld; i++){
+    if(p->ldheld[i].kind == LD_GROUP &&
+       *(volatile int *)p->ldheld[i].lock != p->pid)
+      continue;
+    p->ldheld[j++] = p->ldheld[i];
+  }
+  p->ldnheld = j;
+}
+
+// Would acquiring class with these locks held add a new edge?
+static int
+ld_newedges(struct ldheld *h, int n, int class)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(h[i].class != class && !ld_hasedge(h[i].class, class))
+      return 1;
+  return 0;
+}
+
+// Called before waiting for lock, a lock of the given kind whose
+// class is called name. *cache is the lock's ldclass field.
+void
+lockdep_acquire(void *lock, char *name, int *cache, int kind)
+{
+  struct cpu *c;
+  struct proc *p;
+  struct ldreport r;
+  struct ldheld *h;
+  int *nheld;
+  int class, i, warn;
+
+  push_off();
+  c = mycpu();
+
+  // The process's locks are only held by code running on its
+  // behalf; an interrupt handler (interrupts were off before the
+  // outermost push_off) has not acquired them.
+  p = c->proc;
+  if(p != 0 && c->intena)
+    ld_prune(p);
+  else
+    p = 0;
+
+  r.n = 0;
+  warn = 0;
+  class = *cache - 1;
+  if(class < 0 || ld_newedges(c->ldheld, c->ldnheld, class) ||
+     (p && ld_newedges(p->ldheld, p->ldnheld, class))){
+    ld_lock();
+    if((class = ld_class(name, cache)) >= 0){
+      for(i = 0; i < c->ldnheld; i++)
+        ld_addedge(c->ldheld[i].class, class, &r);
+      for(i = 0; p && i < p->ldnheld; i++)
+        ld_addedge(p->ldheld[i].class, class, &r);
+    } else if(!ld.warned){
+      ld.warned = warn = 1;
+    }
+    ld_unlock();
+  }
+
+  if(class >= 0 && (kind == LD_SPIN || c->proc != 0)){
+    if(kind == LD_SPIN){
+      h = c->ldheld;
+      nheld = &c->ldnheld;
+    } else {
+      h = c->proc->ldheld;
+      nheld = &c->proc->ldnheld;
+    }
+    if(*nheld < LD_MAXHELD){
+      h[*nheld].lock = lock;
+      h[*nheld].class = class;
+      h[*nheld].kind = kind;
+      (*nheld)++;
+    } else if(!ld.warned){
+      ld.warned = warn = 1;
+    }
+  }
+
+  // Print without ld.locked: printf takes locks of its own.
+  if(warn)
+    printf("lockdep: out of classes or held-lock slots, some locks not tracked\n");
+  if(r.n)
+    ld_print(&r);
+  pop_off();
+}
+
+// Called when lock is released. Locks may be released in any order.
+void
+lockdep_release(void *lock, int kind)
+{
+  struct cpu *c;
+  struct ldheld *h;
+  int *nheld;
+  int i;
+
+  push_off();
+  c = mycpu();
+  if(kind == LD_SPIN){
+    h = c->ldheld;
+    nheld = &c->ldnheld;
+  } else if(c->proc){
+    h = c->proc->ldheld;
+    nheld = &c->proc->ldnheld;
+  } else {
+    pop_off();
+    return;
+  }
+  for(i = *nheld - 1; i >= 0; i--){
+    if(h[i].lock == lock){
+      for(; i < *nheld - 1; i++)
+        h[i] = h[i+1];
+      (*nheld)--;
+      break;
+    }
+  }
+  pop_off();
+}
+
+#endif // LOCKDEP
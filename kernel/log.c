@@ -16,195 +16,663 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. Usually begin_op() just reserves
+// MAXOPBLOCKS blocks of the transaction for the call and
+// returns. But if the reservations would exceed what the
+// log can hold, it sleeps until the last outstanding
+// end_op() commits. Calls that write more, like a large
+// write(), reserve up to log_maxop() blocks with
+// begin_opn()/end_opn().
+//
+// Commits are delayed: end_op() leaves the transaction open,
+// so that later calls can join it, and the logflush kernel
+// thread commits it once it is LOGDELAY ticks old. It commits
+// sooner if begin_op() finds it full, log_force() (fsync) asks,
+// or it has freed so many blocks that it journals all file data
+// (see log_free()); the caller then does the commit itself if no
+// other call is active. A crash loses at most the open
+// transaction.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// Its size comes from the superblock, so mkfs decides it.
+// It is split into NREGION regions, which successive commits
+// use in turn. The on-disk format of a region:
+//   header block, containing a sequence number, a checksum
+//     and block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+//
+// A commit copies the transaction's blocks into staging buffers
+// that belong to its region, then opens the next transaction, so
+// new FS system calls only wait for the copy, not the disk. The
+// header and the staging buffers go to the region in one batch of
+// disk requests. The checksum covers the header and the blocks,
+// so a region whose writes did not all reach the disk does not
+// check out, and the transaction commits once the last write is
+// done. Installing the blocks at their home locations is left to
+// the logd kernel thread, which writes the same staging buffers
+// there, freeing the region for the commit after next. The cached
+// blocks stay pinned until they are installed.
+//
+// File data is not journaled (ordered mode): log_write_data()
+// blocks take part in the transaction, but commit() writes them
+// straight to their home locations before writing the region, so
+// data reaches the disk once and is there before any metadata that
+// points at it. A block that one of the regions logs as metadata is
+// logged as metadata again instead, so that replaying the region
+// cannot overwrite newer data with it. So is a block that the open
+// transaction freed (log_free()): until the transaction commits,
+// the tree on disk may still use the block as a directory, an
+// indirect block or another file's data, and writing new data over
+// it early would corrupt that tree if the system crashed before the
+// header reached the disk. Commits are serialized, so a block freed
+// by an earlier transaction is free on disk before any later
+// transaction writes data home.
+//
+// Nothing erases a region after it is installed. Recovery replays
+// every region that checks out, in sequence order; installing a
+// transaction again is harmless as long as the newest one comes
+// last. Since commits alternate between the regions, a new commit
+// always overwrites the older of the two transactions on disk, so
+// the one left is never older than anything installed.
+
+#define NREGION 2   // log regions, used in turn by successive commits
+#define LOGDELAY 10 // ticks a transaction stays open before commit
 
-// Contents of the header block, used for both the on-disk header block
+// struct logheader (fs.h) is used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
-struct logheader {
-  int n;
-  int block[LOGSIZE];
+// block[] has room for log.cap entries.
+
+// Most blocks a transaction can hold while the arrays of buffer
+// pointers, one per staging buffer, still fit in a page.
+#define LOGCAPMAX (PGSIZE / sizeof(struct buf*) - 1)
+
+// Slots in the table of blocks the open transaction freed. Once it
+// holds REVOKEMAX, all data in the transaction is journaled.
+#define NREVOKE (PGSIZE / sizeof(uint))
+#define REVOKEMAX (NREVOKE / 4 * 3)
+
+// Bytes of a header naming n blocks.
+#define LHSIZE(n) (sizeof(struct logheader) + (n) * sizeof(int))
+
+// What a region holds.
+enum { RFREE, RCOMMIT, RDONE, RINSTALL };
+
+struct region {
+  int state;           // RFREE, or its transaction is being
+                       // committed, waits for logd, is being installed
+  int start;           // block # of the header; the data follows
+  struct logheader *lh; // the transaction in the region
+  struct buf **buf;    // staging buffers, not in the cache:
+                       // [0] for the header, [1..] for the data.
+                       // owned by whoever moved the region out of
+                       // RFREE or RDONE, so they need no locks.
+  struct buf **pinned; // the transaction's cached blocks,
+                       // the lh->n logged ones, then ndata data ones
+  int ndata;           // data blocks written home by commit()
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // most blocks in one transaction
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // blocks they may still add to the transaction
+  int closing;     // commit() is copying the open transaction, please wait.
+  int committing;  // in commit(): only one commit at a time.
+  int full;        // begin_op() is waiting for log space.
+  int force;       // log_force() is waiting for the open transaction.
+  uint opened;     // ticks when the open transaction got its first block
+  uint committed;  // seq of the last transaction on disk
   int dev;
-  struct logheader lh;
+  int cur;         // region the open transaction will commit to
+  struct logheader *lh; // the open transaction
+  struct buf **bufs;    // its cached blocks
+  char *isdata;         // which of them are file data
+  uint *revoke;         // blocks it freed: open hash table, 0 empty
+  int nrevoke;          // entries in revoke
+  int crashat;          // log_crash(): commits until a simulated crash
+  int crashtorn;        // and whether it writes part of the commit
+  struct region region[NREGION];
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logd(void);
+static void logflush(void);
+
+// Allocate size bytes of memory that is never freed,
+// for the staging buffers. size is at most a page.
+static void*
+logalloc(int size)
+{
+  static char *mem;
+  static int left;
+  void *p;
+
+  if(size > PGSIZE)
+    panic("logalloc: too big");
+  if(size > left){
+    if((mem = kalloc()) == 0)
+      panic("logalloc");
+    left = PGSIZE;
+  }
+  p = mem;
+  mem += size;
+  left -= size;
+  return p;
+}
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  struct region *rg;
+  int rsize, nbuf, i;
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+
+  rsize = log.size / NREGION;
+  log.cap = rsize - 1 < LOGHDRMAX ? rsize - 1 : LOGHDRMAX;
+  if(log.cap > LOGCAPMAX)
+    log.cap = LOGCAPMAX;
+  if(log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  // A region's header and the blocks it names; any rest of the
+  // region goes unused.
+  nbuf = log.cap + 1;
+  log.lh = logalloc(LHSIZE(log.cap));
+  log.bufs = logalloc(log.cap * sizeof(struct buf*));
+  log.isdata = logalloc(log.cap);
+  log.revoke = logalloc(NREVOKE * sizeof(uint));
+  memset(log.revoke, 0, NREVOKE * sizeof(uint));
+  for(rg = log.region; rg < log.region+NREGION; rg++){
+    rg->start = log.start + (rg - log.region) * rsize;
+    rg->buf = logalloc(nbuf * sizeof(struct buf*));
+    for(i = 0; i < nbuf; i++){
+      rg->buf[i] = logalloc(sizeof(struct buf));
+      memset(rg->buf[i], 0, sizeof(struct buf));
+      rg->buf[i]->dev = dev;
+      rg->buf[i]->data = logalloc(BSIZE);
+    }
+    rg->lh = logalloc(LHSIZE(log.cap));
+    rg->pinned = logalloc(log.cap * sizeof(struct buf*));
+  }
+
   recover_from_log();
+  kthread(logd, "logd");
+  kthread(logflush, "logflush");
 }
 
-// Copy committed blocks from log to their home location
+// Read or write the staging buffers bs[0..n-1], each at its
+// blockno, and wait for the disk.
 static void
-install_trans(int recovering)
+log_rw(struct buf **bs, int n, int write)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+  virtio_disk_submit(bs, n, write);
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
 }
 
-// Read the log header from disk into the in-memory log header
+// Copy committed blocks from the region's staging buffers
+// to their home location.
 static void
-read_head(void)
+install_trans(struct region *rg)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+
+  for (i = 0; i < rg->lh->n; i++)
+    rg->buf[i+1]->blockno = rg->lh->block[i];
+  log_rw(rg->buf + 1, rg->lh->n, 1);
+}
+
+// Checksum of the transaction in rg: its header, apart from
+// sum itself, and the logged blocks in the staging buffers.
+// 32-bit FNV-1a, a word at a time.
+static uint
+logsum(struct region *rg)
+{
+  struct logheader *lh = rg->lh;
+  uint h = 2166136261;
+  uint *w;
+  int i, j;
+
+#define FNV(x) (h = (h ^ (x)) * 16777619)
+  FNV(lh->seq);
+  FNV(lh->n);
+  for(i = 0; i < lh->n; i++)
+    FNV(lh->block[i]);
+  for(i = 0; i < lh->n; i++){
+    w = (uint *) rg->buf[i+1]->data;
+    for(j = 0; j < BSIZE / sizeof(uint); j++)
+      FNV(w[j]);
   }
-  brelse(buf);
+#undef FNV
+  return h;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Read the region's transaction from disk into rg->lh and
+// the staging buffers. Returns 1 if it checks out, 0 if the
+// region is empty, torn or stale.
+static int
+read_trans(struct region *rg)
+{
+  struct logheader *lh = (struct logheader *) (rg->buf[0]->data);
+  int i;
+
+  rg->buf[0]->blockno = rg->start;
+  log_rw(rg->buf, 1, 0);
+  if(lh->n <= 0 || lh->n > log.cap)
+    return 0;
+  memmove(rg->lh, lh, LHSIZE(lh->n));
+  for(i = 0; i < rg->lh->n; i++)
+    rg->buf[i+1]->blockno = rg->start + 1 + i;
+  log_rw(rg->buf + 1, rg->lh->n, 0);
+  return logsum(rg) == rg->lh->sum;
+}
+
+// Write the transaction in rg->lh and the staging buffers to
+// the region, header first, all in one go. Once the last of
+// them is on disk, the transaction has committed. If torn is
+// set, leave out the last block, as a crash part way through
+// the write might; the checksum must then reject it.
 static void
-write_head(void)
+write_trans(struct region *rg, int torn)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
+  struct logheader *hb = (struct logheader *) (rg->buf[0]->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
-  bwrite(buf);
-  brelse(buf);
+
+  rg->lh->sum = logsum(rg);
+  memmove(hb, rg->lh, LHSIZE(rg->lh->n));
+  for (i = 0; i <= rg->lh->n; i++)
+    rg->buf[i]->blockno = rg->start + i;
+  log_rw(rg->buf, rg->lh->n + 1 - torn, 1);
 }
 
+// Replay the committed transactions, oldest first.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct region *rg, *r;
+  int ok[NREGION];
+  uint seq;
+
+  // Next commit goes to the region with the oldest transaction.
+  for(rg = log.region; rg < log.region+NREGION; rg++){
+    ok[rg - log.region] = read_trans(rg);
+    if(!ok[rg - log.region]){
+      rg->lh->seq = 0;
+      rg->lh->n = 0;
+    }
+  }
+  seq = 0;
+  for(rg = log.region; rg < log.region+NREGION; rg++){
+    if(rg->lh->seq >= seq)
+      seq = rg->lh->seq + 1;
+    if(rg->lh->seq < log.region[log.cur].lh->seq)
+      log.cur = rg - log.region;
+  }
+  log.lh->seq = seq;
+  log.committed = seq - 1;
+
+  for(;;){
+    rg = 0;
+    for(r = log.region; r < log.region+NREGION; r++)
+      if(ok[r - log.region] && (rg == 0 || r->lh->seq < rg->lh->seq))
+        rg = r;
+    if(rg == 0)
+      break;
+    install_trans(rg); // copy from the staging buffers to disk
+    ok[rg - log.region] = 0;
+  }
+}
+
+// Should the open transaction be committed now?
+// Caller holds log.lock.
+static int
+commit_due(void)
+{
+  return log.lh->n > 0 &&
+    (log.full || log.force || ticks - log.opened >= LOGDELAY ||
+     log.nrevoke >= REVOKEMAX);
 }
 
-// called at the start of each FS system call.
+// Commit while commit_due(). The caller has set log.committing,
+// and found no FS system calls active.
+static void
+flush(void)
+{
+  int more = 1;
+
+  while(more){
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+    acquire(&log.lock);
+    if(log.outstanding > 0 || !commit_due()){
+      log.committing = 0;
+      more = 0;
+    }
+    wakeup(&log);
+    release(&log.lock);
+  }
+}
+
+// called at the start of each FS system call
+// that may write up to n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log.cap)
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing || log.force){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh->n + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      log.full = 1;
+      if(log.outstanding == 0 && !log.committing){
+        // no end_op() is coming to commit it.
+        log.committing = 1;
+        release(&log.lock);
+        flush();
+        acquire(&log.lock);
+      } else {
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call,
+// with the n passed to begin_opn().
+// commits if this was the last outstanding operation
+// and the transaction is due, unless another commit
+// is under way, which will then commit this one too.
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.closing)
+    panic("log.closing");
+  if(log.outstanding == 0 && !log.committing && commit_due()){
     do_commit = 1;
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+  if(do_commit)
+    flush();
+}
+
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Commit the open transaction, if it has anything in it,
+// and wait until it and any commit in flight are on disk.
+void
+log_force(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  seq = log.lh->n > 0 ? log.lh->seq : log.lh->seq - 1;
+  while((int)(log.committed - seq) < 0){
+    if(log.lh->seq == seq){
+      log.force = 1;
+      if(log.outstanding == 0 && !log.committing){
+        log.committing = 1;
+        release(&log.lock);
+        flush();
+        acquire(&log.lock);
+        continue;
+      }
+    }
+    sleep(&log.committed, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// The most blocks one FS system call should reserve: half a
+// transaction, so that two large ones can share it.
+int
+log_maxop(void)
+{
+  return log.cap / 2 > MAXOPBLOCKS ? log.cap / 2 : MAXOPBLOCKS;
+}
+
+static void
+commit()
+{
+  struct region *rg;
+  int i, m;
+
+  acquire(&log.lock);
+  rg = &log.region[log.cur];
+  while(rg->state != RFREE){
+    // logd has not installed the region's last transaction yet.
+    // FS system calls may keep joining the open one meanwhile.
+    sleep(rg, &log.lock);
+  }
+  if(log.outstanding > 0 || log.lh->n == 0){
+    // end_op() will try again once they are done.
     release(&log.lock);
+    return;
+  }
+  log.closing = 1;
+  rg->state = RCOMMIT;
+  // Logged blocks first, then data.
+  rg->lh->seq = log.lh->seq;
+  m = 0;
+  for (i = 0; i < log.lh->n; i++) {
+    if (!log.isdata[i]) {
+      rg->lh->block[m] = log.lh->block[i];
+      rg->pinned[m++] = log.bufs[i];
+    }
+  }
+  rg->lh->n = m;
+  rg->ndata = 0;
+  for (i = 0; i < log.lh->n; i++) {
+    if (log.isdata[i]) {
+      rg->buf[m+rg->ndata+1]->blockno = log.lh->block[i];
+      rg->pinned[m+rg->ndata++] = log.bufs[i];
+    }
+  }
+  release(&log.lock);
+
+  // Copy modified blocks from cache to the staging buffers,
+  // while begin_op() keeps new operations from changing them.
+  for (i = 0; i < m + rg->ndata; i++) {
+    struct buf *b = rg->pinned[i];
+    acquiresleep(&b->lock);
+    memmove(rg->buf[i+1]->data, b->data, BSIZE);
+    releasesleep(&b->lock);
+  }
+
+  // Open the next transaction, in the next region.
+  acquire(&log.lock);
+  log.lh->n = 0;
+  if(log.nrevoke > 0){
+    memset(log.revoke, 0, NREVOKE * sizeof(uint));
+    log.nrevoke = 0;
+  }
+  log.lh->seq++;
+  log.cur = (log.cur + 1) % NREGION;
+  log.closing = 0;
+  log.full = 0;
+  log.force = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  if (rg->ndata > 0) {
+    // Data goes home before metadata that points to it commits.
+    log_rw(rg->buf + 1 + m, rg->ndata, 1);
+    for (i = m; i < m + rg->ndata; i++)
+      bunpin(rg->pinned[i]);
   }
+  if(log.crashat > 0 && --log.crashat == 0){
+    if(log.crashtorn)
+      write_trans(rg, 1);
+    panic("log_crash");
+  }
+  write_trans(rg, 0);   // Write header and blocks -- the real commit
+
+  // Leave installing to logd.
+  acquire(&log.lock);
+  log.committed = rg->lh->seq;
+  wakeup(&log.committed);
+  rg->state = RDONE;
+  wakeup(&log.region);
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Kernel thread that installs committed transactions at their
+// home locations, oldest first, and then frees their regions.
 static void
-write_log(void)
+logd(void)
 {
-  int tail;
+  struct region *rg, *r;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  acquire(&log.lock);
+  for(;;){
+    rg = 0;
+    for(r = log.region; r < log.region+NREGION; r++)
+      if(r->state == RDONE && (rg == 0 || r->lh->seq < rg->lh->seq))
+        rg = r;
+    if(rg == 0){
+      sleep(&log.region, &log.lock);
+      continue;
+    }
+    rg->state = RINSTALL;
+    release(&log.lock);
+
+    install_trans(rg); // Now install writes to home locations
+    for (i = 0; i < rg->lh->n; i++)
+      bunpin(rg->pinned[i]);
+
+    acquire(&log.lock);
+    rg->state = RFREE;
+    wakeup(rg);
   }
 }
 
+// Is blockno logged in one of the regions?
+// Caller holds log.lock.
+static int
+inregion(uint blockno)
+{
+  struct region *rg;
+  int i;
+
+  for(rg = log.region; rg < log.region+NREGION; rg++)
+    for(i = 0; i < rg->lh->n; i++)
+      if(rg->lh->block[i] == blockno)
+        return 1;
+  return 0;
+}
+
+// Did the open transaction free blockno? Also true for every block
+// once the table is too full to tell. Caller holds log.lock.
+static int
+revoked(uint blockno)
+{
+  uint h;
+
+  if(log.nrevoke >= REVOKEMAX)
+    return 1;
+  for(h = blockno % NREVOKE; log.revoke[h] != 0; h = (h + 1) % NREVOKE)
+    if(log.revoke[h] == blockno)
+      return 1;
+  return 0;
+}
+
+// Add b to the open transaction, as file data if data is set.
 static void
-commit()
+log_add(struct buf *b, int data)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int i;
+
+  acquire(&log.lock);
+  if (log.lh->n >= log.cap)
+    panic("too big a transaction");
+  if (log.outstanding < 1)
+    panic("log_write outside of trans");
+
+  if (data && (inregion(b->blockno) || revoked(b->blockno)))
+    data = 0;
+  for (i = 0; i < log.lh->n; i++) {
+    if (log.lh->block[i] == b->blockno)   // log absorption
+      break;
+  }
+  log.lh->block[i] = b->blockno;
+  if (i == log.lh->n) {  // Add new block to log?
+    if (i == 0)
+      log.opened = ticks;
+    bpin(b);
+    log.bufs[i] = b;
+    log.isdata[i] = data;
+    log.lh->n++;
+  } else if (!data) {
+    log.isdata[i] = 0;
+  }
+  release(&log.lock);
+}
+
+// Kernel thread that commits transactions that have been open
+// for LOGDELAY ticks.
+static void
+logflush(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.outstanding == 0 && !log.committing && commit_due()){
+      log.committing = 1;
+      release(&log.lock);
+      flush();
+      acquire(&log.lock);
+    } else {
+      // clockintr() wakes up sleepers on ticks every tick.
+      sleep(&ticks, &log.lock);
+    }
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_trans() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -214,23 +682,47 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
+  log_add(b, 0);
+}
 
-  acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
-  if (log.outstanding < 1)
-    panic("log_write outside of trans");
+// Like log_write(), for a block of file data. commit() writes
+// it to its home location rather than to the log.
+void
+log_write_data(struct buf *b)
+{
+  log_add(b, 1);
+}
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
-  }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
-    log.lh.n++;
+// Note that the open transaction frees blockno, so that it is
+// journaled if it is reused for file data before the commit.
+// Called by bfree(), inside a transaction.
+void
+log_free(uint blockno)
+{
+  uint h;
+
+  acquire(&log.lock);
+  if(log.nrevoke < REVOKEMAX){
+    for(h = blockno % NREVOKE; log.revoke[h] != 0; h = (h + 1) % NREVOKE)
+      if(log.revoke[h] == blockno)
+        break;
+    if(log.revoke[h] == 0){
+      log.revoke[h] = blockno;
+      log.nrevoke++;
+    }
   }
   release(&log.lock);
 }
 
+// Simulate a crash in the nth commit from now: panic after its
+// file data has gone home but before its header is written, or,
+// if torn is set, after the header and all but one of its blocks,
+// so that the next boot recovers without it. For crash tests.
+void
+log_crash(int n, int torn)
+{
+  acquire(&log.lock);
+  log.crashat = n;
+  log.crashtorn = torn;
+  release(&log.lock);
+}
@@ -54,6 +54,8 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   GLBASE (grouplock word pages, each mapped by grouplock_open())
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define GLBASE (TRAPFRAME - NGLPAGE*PGSIZE)
@@ -2,14 +2,17 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // initial size of the in-memory inode table
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
-#define MAXPATH      128   // maximum file path name
+#define LOGSIZE      (MAXOPBLOCKS*12) // default blocks in on-disk log (mkfs -l)
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define NBUFMAX      4096  // default limit on size of disk block cache
+#define KRESERVE     512   // free pages that caches leave for everyone else
+#define FSSIZE       2000  // default size of file system in blocks (mkfs -s)
+#define MAXPATH      512   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define NGLPAGE      1024  // user-mapped grouplock word pages, one per lock
 
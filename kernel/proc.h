@@ -18,12 +18,32 @@ struct context {
   uint64 s11;
 };
 
+#ifdef LOCKDEP
+// Lock kinds for lockdep_acquire() and lockdep_release().
+#define LD_SPIN   0           // spinlock, held by a CPU
+#define LD_SLEEP  1           // sleeplock, held by a process
+#define LD_GROUP  2           // group lock, held by a process
+
+#define LD_MAXHELD 16         // max locks lockdep tracks per CPU/process
+
+// An entry on a lockdep held-lock stack.
+struct ldheld {
+  void *lock;
+  int class;
+  int kind;
+};
+#endif
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+#ifdef LOCKDEP
+  struct ldheld ldheld[LD_MAXHELD]; // Spinlocks held by this cpu
+  int ldnheld;
+#endif
 };
 
 extern struct cpu cpus[NCPU];
@@ -104,4 +124,9 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // If non-zero, kernel thread's function
+#ifdef LOCKDEP
+  struct ldheld ldheld[LD_MAXHELD]; // Sleep and group locks held
+  int ldnheld;
+#endif
 };
@@ -9,6 +9,10 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// How long acquiresleep() polls a lock whose holder is running on
+// another CPU before going to sleep, in time-CSR cycles (~20us).
+#define SLEEPLOCK_SPIN 200
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -16,26 +20,63 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+#ifdef LOCKDEP
+  lk->ldclass = 0;
+#endif
+}
+
+// Is lk held by a process that is currently running on a CPU?
+// Read without locks; it is only a hint for whether to spin.
+static int
+owner_running(struct sleeplock *lk)
+{
+  struct proc *owner = *(struct proc * volatile *)&lk->owner;
+
+  return *(volatile uint *)&lk->locked && owner != 0 &&
+         *(volatile enum procstate *)&owner->state == RUNNING;
 }
 
+// Adaptive acquire: a holder that is running on another CPU will
+// usually release soon (short buffer-cache and inode critical
+// sections), so poll for a little while before paying for a sleep
+// and a context switch. Sleep right away if the holder is not running.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+  uint64 deadline = r_time() + SLEEPLOCK_SPIN;
+
+#ifdef LOCKDEP
+  lockdep_acquire(lk, lk->name, &lk->ldclass, LD_SLEEP);
+#endif
   acquire(&lk->lk);
   while (lk->locked) {
+    if(owner_running(lk) && r_time() < deadline){
+      release(&lk->lk);
+      while(owner_running(lk) && r_time() < deadline)
+        ;
+      acquire(&lk->lk);
+      continue;
+    }
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->pid = p->pid;
+  lk->owner = p;
   release(&lk->lk);
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
+#ifdef LOCKDEP
+  lockdep_release(lk, LD_SLEEP);
+#endif
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
   wakeup(lk);
   release(&lk->lk);
 }
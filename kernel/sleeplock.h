@@ -6,5 +6,9 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner; // Process holding lock, for adaptive spinning
+#ifdef LOCKDEP
+  int ldclass;       // Lockdep class + 1, or 0 if not looked up yet
+#endif
 };
 
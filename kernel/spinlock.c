@@ -14,6 +14,9 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+#ifdef LOCKDEP
+  lk->ldclass = 0;
+#endif
 }
 
 // Acquire the lock.
@@ -24,6 +27,9 @@ acquire(struct spinlock *lk)
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
+#ifdef LOCKDEP
+  lockdep_acquire(lk, lk->name, &lk->ldclass, LD_SPIN);
+#endif
 
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
@@ -48,6 +54,9 @@ release(struct spinlock *lk)
 {
   if(!holding(lk))
     panic("release");
+#ifdef LOCKDEP
+  lockdep_release(lk, LD_SPIN);
+#endif
 
   lk->cpu = 0;
 
@@ -10,6 +10,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+#ifdef LOCKDEP
+  int ldclass;       // Lockdep class + 1, or 0 if not looked up yet
+#endif
 };
 
 #endif
\ No newline at end of file
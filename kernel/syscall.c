@@ -110,6 +110,16 @@ extern uint64 sys_grouplock_release(void);
 extern uint64 sys_grouplock_verify(void);
 extern uint64 sys_grouplock_destroy(void);
 extern uint64 sys_grouplock_debug(void);
+extern uint64 sys_grouplock_open(void);
+extern uint64 sys_grouplock_wake(void);
+extern uint64 sys_grouplock_get(void);
+extern uint64 sys_grouplock_stats(void);
+extern uint64 sys_bcachestat(void);
+extern uint64 sys_bcachesize(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_icachestat(void);
+extern uint64 sys_logcrash(void);
+extern uint64 sys_fbmap(void);
 
 
 // An array mapping syscall numbers from syscall.h
@@ -145,6 +155,16 @@ static uint64 (*syscalls[])(void) = {
 [SYS_grouplock_destroy] sys_grouplock_destroy,
 [SYS_grouplock_verify] sys_grouplock_verify,
 [SYS_grouplock_debug] sys_grouplock_debug,
+[SYS_grouplock_open] sys_grouplock_open,
+[SYS_grouplock_wake] sys_grouplock_wake,
+[SYS_grouplock_get] sys_grouplock_get,
+[SYS_grouplock_stats] sys_grouplock_stats,
+[SYS_bcachestat] sys_bcachestat,
+[SYS_bcachesize] sys_bcachesize,
+[SYS_fsync]   sys_fsync,
+[SYS_icachestat] sys_icachestat,
+[SYS_logcrash] sys_logcrash,
+[SYS_fbmap]   sys_fbmap,
 };
 
 void
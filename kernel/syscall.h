@@ -29,5 +29,15 @@
 #define SYS_grouplock_destroy 27
 #define SYS_grouplock_verify 28
 #define SYS_grouplock_debug 29
+#define SYS_grouplock_open 30
+#define SYS_grouplock_wake 31
+#define SYS_grouplock_get 32
+#define SYS_grouplock_stats 33
+#define SYS_bcachestat 34
+#define SYS_bcachesize 35
+#define SYS_fsync 36
+#define SYS_icachestat 37
+#define SYS_logcrash 38
+#define SYS_fbmap 39
 
 
@@ -119,11 +119,59 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until changes to the file system are on disk. Commits
+// are not tracked per file, so this commits everything pending.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  iorphanwait();
+  log_force();
+  return 0;
+}
+
+// Have the nth commit from now crash the system part way, after
+// writing file data home and before its log header, or if torn,
+// after only part of the commit; for tests of crash recovery.
+uint64
+sys_logcrash(void)
+{
+  int n, torn;
+
+  argint(0, &n);
+  argint(1, &torn);
+  if(n < 1)
+    return -1;
+  log_crash(n, torn != 0);
+  return 0;
+}
+
+// Return the disk block holding block bn of the file fd, or 0
+// if it has none; for tests of block allocation.
+uint64
+sys_fbmap(void)
+{
+  struct file *f;
+  int bn;
+  uint addr;
+
+  argint(1, &bn);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE || bn < 0)
+    return -1;
+  ilock(f->ip);
+  addr = ibmap(f->ip, bn);
+  iunlock(f->ip);
+  return addr;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
 {
-  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
+  char name[DIRSIZ+1], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
@@ -170,16 +218,21 @@ bad:
 }
 
 // Is the directory dp empty except for "." and ".." ?
+// Those are the first two entries, and are never removed.
 static int
 isdirempty(struct inode *dp)
 {
-  int off;
+  uint off;
+  int n;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  n = 0;
+  for(off=0; off<dp->size; off+=de.reclen){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.reclen == 0)
+      panic("isdirempty: reclen");
+    if(de.inum != 0 && n++ >= 2)
       return 0;
   }
   return 1;
@@ -189,8 +242,7 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
-  char name[DIRSIZ], path[MAXPATH];
+  char name[DIRSIZ+1], path[MAXPATH];
   uint off;
 
   if(argstr(0, path, MAXPATH) < 0)
@@ -219,9 +271,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -246,7 +296,7 @@ static struct inode*
 create(char *path, short type, short major, short minor)
 {
   struct inode *ip, *dp;
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
 
   if((dp = nameiparent(path, name)) == 0)
     return 0;
@@ -341,6 +391,12 @@ sys_open(void)
     return -1;
   }
 
+  if((omode & O_TRUNC) && ip->type == T_FILE && itrunc(ip) < 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -360,10 +416,6 @@ sys_open(void)
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
-  if((omode & O_TRUNC) && ip->type == T_FILE){
-    itrunc(ip);
-  }
-
   iunlock(ip);
   end_op();
 
@@ -96,6 +96,35 @@ sys_freemem(void) {
     return freemem_amount();
 }
 
+uint64
+sys_bcachestat(void)
+{
+  uint64 st;
+
+  argaddr(0, &st);
+  return bcache_stats(st);
+}
+
+// Set the buffer cache size limit, in buffers.
+// Returns the limit set, which is never below NBUF.
+uint64
+sys_bcachesize(void)
+{
+  int n;
+
+  argint(0, &n);
+  return bcache_setmax(n);
+}
+
+uint64
+sys_icachestat(void)
+{
+  uint64 st;
+
+  argaddr(0, &st);
+  return icache_stats(st);
+}
+
 // A helper function to print PTE flags
 static void
 print_pte_flags(pte_t pte)
@@ -160,39 +189,49 @@ sys_pgtableinfo(void)
 
 
 uint64 sys_grouplock_create(void) {
-    int group_id;
-    char name[16];
+    uint64 key;
+    char name[GL_NAMELEN];
     
-    argint(0, &group_id);
-    if (argstr(1, name, 16) < 0) {
+    argaddr(0, &key);
+    if (argstr(1, name, GL_NAMELEN) < 0) {
         return -1;
     }
     
-    return grouplock_create(group_id, name);
+    return grouplock_create(key, name);
+}
+
+uint64 sys_grouplock_get(void) {
+    char name[GL_NAMELEN];
+    
+    if (argstr(0, name, GL_NAMELEN) < 0) {
+        return 0;
+    }
+    
+    return grouplock_get(name);
 }
 
 uint64 sys_grouplock_acquire(void) {
-    int group_id;
+    uint64 key;
     
-    argint(0, &group_id);
+    argaddr(0, &key);
     
-    return grouplock_acquire(group_id);
+    return grouplock_acquire(key);
 }
 
 uint64 sys_grouplock_release(void) {
-    int group_id;
+    uint64 key;
     
-    argint(0, &group_id);
+    argaddr(0, &key);
     
-    return grouplock_release(group_id);
+    return grouplock_release(key);
 }
 
 uint64 sys_grouplock_destroy(void) {
-    int group_id;
+    uint64 key;
     
-    argint(0, &group_id);
+    argaddr(0, &key);
     
-    return grouplock_destroy(group_id);
+    return grouplock_destroy(key);
 }
 
 uint64 sys_grouplock_verify(void) {
@@ -204,10 +243,37 @@ uint64 sys_grouplock_verify(void) {
 }
 
 uint64 sys_grouplock_debug(void) {
-    int group_id;
+    uint64 key;
     
-    argint(0, &group_id);
+    argaddr(0, &key);
     
-    grouplock_debug_info(group_id);
+    grouplock_debug_info(key);
     return 0;
 }
+
+uint64 sys_grouplock_open(void) {
+    uint64 key;
+    
+    argaddr(0, &key);
+    
+    return grouplock_open(key);
+}
+
+uint64 sys_grouplock_wake(void) {
+    uint64 key, hold;
+    
+    argaddr(0, &key);
+    argaddr(1, &hold);
+    
+    return grouplock_wake(key, hold);
+}
+
+uint64 sys_grouplock_stats(void) {
+    uint64 addr;
+    int max;
+    
+    argaddr(0, &addr);
+    argint(1, &max);
+    
+    return grouplock_stats(addr, max);
+}
@@ -45,9 +45,13 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// this many virtio descriptors, enough for NUM/3 requests in
+// flight at once. must be a power of two, and at most 256 so
+// that the descriptor table fits in a page.
+#define NUM 128
+
+// most blocks in a single request, each with its own descriptor.
+#define MAXSEG 16
 
 // a single descriptor, from the spec.
 struct virtq_desc {
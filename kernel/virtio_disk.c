@@ -196,12 +196,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +211,29 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// build one request for the longest prefix of bs[0..n-1] whose
+// blocks are contiguous on disk, up to MAXSEG of them, and add it
+// to the avail ring. the device does not look until kick().
+// returns the number of bufs the request covers, or 0 if there
+// are not enough free descriptors. caller holds vdisk_lock.
+static int
+post_req(struct buf **bs, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  int idx[MAXSEG+2];
+  int k, i;
 
-  acquire(&disk.vdisk_lock);
+  for(k = 1; k < n && k < MAXSEG; k++)
+    if(bs[k]->dev != bs[0]->dev || bs[k]->blockno != bs[k-1]->blockno + 1)
+      break;
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then the data, then
+  // one for a 1-byte status result. the data may be split over
+  // several descriptors: here, one per buf.
+  if(allocn_desc(idx, k + 2) < 0)
+    return 0;
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -242,31 +243,36 @@ virtio_disk_rw(struct buf *b, int write)
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
+  buf0->sector = bs[0]->blockno * (BSIZE / 512);
 
   disk.desc[idx[0]].addr = (uint64) buf0;
   disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 0; i < k; i++){
+    struct virtq_desc *d = &disk.desc[idx[i+1]];
+    d->addr = (uint64) bs[i]->data;
+    d->len = BSIZE;
+    if(write)
+      d->flags = 0; // device reads b->data
+    else
+      d->flags = VRING_DESC_F_WRITE; // device writes b->data
+    d->flags |= VRING_DESC_F_NEXT;
+    d->next = idx[i+2];
+
+    // record the bufs for virtio_disk_intr().
+    bs[i]->disk = 1;
+    bs[i]->qnext = i+1 < k ? bs[i+1] : 0;
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[k+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[k+1]].len = 1;
+  disk.desc[idx[k+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[k+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].b = bs[0];
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -276,19 +282,86 @@ virtio_disk_rw(struct buf *b, int write)
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
 
+  return k;
+}
+
+// tell the device to look at the avail ring.
+static void
+kick(void)
+{
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// Queue transfers of the n bufs bs[0..n-1], which the caller has
+// locked, all reads or all writes. Runs of contiguous blocks go
+// to the device as single requests, and the device is told about
+// them in as few batches as the free descriptors allow. Sleeps
+// only while the queue is full; use virtio_disk_wait() to wait
+// for each buf to finish.
+void
+virtio_disk_submit(struct buf **bs, int n, int write)
+{
+  int i, k, queued;
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  acquire(&disk.vdisk_lock);
+  queued = 0;
+  for(i = 0; i < n; i += k){
+    while((k = post_req(bs + i, n - i, write)) == 0){
+      // let the device start on what we have so far.
+      if(queued){
+        kick();
+        queued = 0;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    queued++;
+  }
+  if(queued)
+    kick();
+  release(&disk.vdisk_lock);
+}
+
+// Wait for virtio_disk_intr() to say b's transfer has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(&b, 1, write);
+  virtio_disk_wait(b);
+}
 
+// Start reading the locked bufs bs[0..n-1] and return without
+// waiting; virtio_disk_intr() passes each to breadahead_done()
+// when its data is in. Stops when the descriptors run out, and
+// returns the number of bufs started: bs[0] up to that.
+int
+virtio_disk_read_async(struct buf **bs, int n)
+{
+  int i, j, k;
+
+  acquire(&disk.vdisk_lock);
+  for(i = 0; i < n; i += k){
+    if((k = post_req(bs + i, n - i, 0)) == 0)
+      break;
+    // virtio_disk_intr() cannot see them before we release the lock.
+    for(j = i; j < i + k; j++)
+      bs[j]->readahead = 1;
+  }
+  if(i > 0)
+    kick();
   release(&disk.vdisk_lock);
+  return i;
 }
 
 void
@@ -317,8 +390,17 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    disk.info[id].b = 0;
+    free_chain(id);
+    while(b){
+      struct buf *next = b->qnext;
+      b->disk = 0;   // disk is done with buf
+      if(b->readahead)
+        breadahead_done(b); // no one is waiting in virtio_disk_wait()
+      else
+        wakeup(b);
+      b = next;
+    }
 
     disk.used_idx += 1;
   }
@@ -0,0 +1,505 @@
+// mkfs: build a file system image.
+//
+// usage: mkfs [-s blocks] [-i inodes] [-l logblocks] [-j threads]
+//             [-d dir] fs.img [files...]
+//
+//   -s  size of the file system in blocks (default FSSIZE)
+//   -i  number of inodes (default NINODES)
+//   -l  blocks of log (default LOGSIZE)
+//   -j  threads copying file contents (default: one per CPU)
+//   -d  copy the tree under the host directory dir into the root
+//
+// The files named on the command line go in the root directory,
+// without any leading "user/" and "_".
+//
+// The image is mapped into memory and built there. Layout comes
+// first, in one thread: every inode, directory and block is placed,
+// with each file's data blocks contiguous. Then the threads read
+// the files' contents straight into their blocks, one read() per
+// file.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct dirent hostdirent;
+#define stat xv6_stat  // avoid clash with host struct stat
+#define dirent xv6_dirent  // avoid clash with host struct dirent
+#include "kernel/types.h"
+#include "kernel/fs.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#undef stat
+
+#ifndef static_assert
+#define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
+#endif
+
+#define NINODES 200
+#define MAXTHREADS 64
+
+// Disk layout:
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+
+struct superblock sb;  // in host byte order
+uchar *img;       // the image, mapped
+uint freeinode = 1;
+uint freeblock;   // blocks below this are in use
+
+// A file's contents, to be read into the image.
+struct job {
+  char *path;     // on the host
+  uchar *dst;     // in the image
+  uint size;
+};
+
+struct job *jobs;
+int njob, maxjob;
+int nextjob;      // next job for a thread to take
+
+// Entries of a directory, built up in memory in the on-disk
+// format before the directory is given blocks.
+struct dirbuf {
+  uint inum;
+  uchar *data;
+  uint size;      // a whole number of blocks
+  uint last;      // offset of the last record
+};
+
+void
+die(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "mkfs: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
+
+// convert to riscv byte order
+ushort
+xshort(ushort x)
+{
+  ushort y;
+  uchar *a = (uchar*)&y;
+  a[0] = x;
+  a[1] = x >> 8;
+  return y;
+}
+
+uint
+xint(uint x)
+{
+  uint y;
+  uchar *a = (uchar*)&y;
+  a[0] = x;
+  a[1] = x >> 8;
+  a[2] = x >> 16;
+  a[3] = x >> 24;
+  return y;
+}
+
+uchar*
+block(uint b)
+{
+  return img + (uint64)b * BSIZE;
+}
+
+struct dinode*
+dinode(uint inum)
+{
+  return (struct dinode*)block(IBLOCK(inum, sb)) + inum % IPB;
+}
+
+// Allocate n contiguous blocks. The image starts out zeroed.
+uint
+balloc(uint n)
+{
+  uint b;
+
+  if(n > sb.size - freeblock)
+    die("out of blocks: make the image bigger with -s");
+  b = freeblock;
+  freeblock += n;
+  return b;
+}
+
+uint
+ialloc(ushort type)
+{
+  uint inum = freeinode++;
+  struct dinode *din;
+
+  if(inum >= sb.ninodes)
+    die("out of inodes: allow more with -i");
+  din = dinode(inum);
+  din->type = xshort(type);
+  din->nlink = xshort(1);
+  return inum;
+}
+
+// Make block fbn of the file be disk block addr, allocating
+// indirect blocks as needed.
+void
+setbn(struct dinode *din, uint fbn, uint addr)
+{
+  uint span, *slot, *ind;
+  int level;
+
+  if(fbn < NDIRECT){
+    din->addrs[fbn] = xint(addr);
+    return;
+  }
+  fbn -= NDIRECT;
+
+  // Which tree is it in: singly, doubly or triply indirect?
+  for(level = 0, span = NINDIRECT; fbn >= span; level++, span *= NINDIRECT){
+    fbn -= span;
+    if(level == 2)
+      die("file too big");
+  }
+
+  // Walk down from the top of the tree.
+  slot = &din->addrs[NDIRECT+level];
+  for(;; level--){
+    if(*slot == 0)
+      *slot = xint(balloc(1));
+    ind = (uint*)block(xint(*slot));
+    span /= NINDIRECT;
+    slot = &ind[fbn / span];
+    fbn %= span;
+    if(level == 0)
+      break;
+  }
+  *slot = xint(addr);
+}
+
+// Place a regular file of size bytes, whose contents are
+// at path on the host. Returns its inode number.
+uint
+addfile(char *path, off_t size)
+{
+  struct dinode *din;
+  struct job *j;
+  uint inum, start, nb, i;
+
+  if(size > (off_t)MAXFILE * BSIZE || size > 0xffffffffL)
+    die("%s: too big", path);
+  inum = ialloc(T_FILE);
+  din = dinode(inum);
+  din->size = xint(size);
+
+  if(njob == maxjob){
+    maxjob = maxjob ? 2 * maxjob : 64;
+    if((jobs = realloc(jobs, maxjob * sizeof(jobs[0]))) == 0)
+      die("out of memory");
+  }
+  j = &jobs[njob++];
+  if((j->path = strdup(path)) == 0)
+    die("out of memory");
+  j->size = size;
+
+  if(size <= NINLINE){
+    din->flags = xint(DI_INLINE);
+    j->dst = (uchar*)din->idata;
+    return inum;
+  }
+
+  nb = (size + BSIZE - 1) / BSIZE;
+  start = balloc(nb);
+  for(i = 0; i < nb; i++)
+    setbn(din, i, start + i);
+  j->dst = block(start);
+  return inum;
+}
+
+// Add the entry (name, inum) to directory d. A record that
+// does not fit in the rest of the last block starts a new one.
+void
+dirappend(struct dirbuf *d, char *name, uint inum)
+{
+  struct dirent *de;
+  int len = strlen(name);
+  uint used, off;
+
+  if(len > DIRSIZ)
+    die("%s: name too long", name);
+  for(off = 0; off < d->size; off += xshort(de->reclen)){
+    de = (struct dirent*)(d->data + off);
+    if(de->inum && de->namelen == len && memcmp(de->name, name, len) == 0)
+      die("%s: duplicate name", name);
+  }
+  if(d->size > 0){
+    de = (struct dirent*)(d->data + d->last);
+    used = DIRENTSIZE(de->namelen);
+    if(xshort(de->reclen) - used >= DIRENTSIZE(len)){
+      de->reclen = xshort(used);
+      d->last += used;
+      goto fill;
+    }
+  }
+  if((d->data = realloc(d->data, d->size + BSIZE)) == 0)
+    die("out of memory");
+  memset(d->data + d->size, 0, BSIZE);
+  d->last = d->size;
+  d->size += BSIZE;
+
+fill:
+  de = (struct dirent*)(d->data + d->last);
+  de->inum = xshort(inum);
+  de->reclen = xshort(d->size - d->last);
+  de->namelen = len;
+  memmove(de->name, name, len);
+}
+
+// Start directory d, with parent directory parent
+// (0: d is the root).
+void
+dirinit(struct dirbuf *d, struct dirbuf *parent)
+{
+  struct dinode *pin;
+
+  memset(d, 0, sizeof(*d));
+  d->inum = ialloc(T_DIR);
+  dirappend(d, ".", d->inum);
+  dirappend(d, "..", parent ? parent->inum : d->inum);
+  if(parent){
+    // for ".."
+    pin = dinode(parent->inum);
+    pin->nlink = xshort(xshort(pin->nlink) + 1);
+  }
+}
+
+// Give directory d its blocks.
+void
+dirfinish(struct dirbuf *d)
+{
+  struct dinode *din = dinode(d->inum);
+  uint start, i;
+
+  start = balloc(d->size / BSIZE);
+  memmove(block(start), d->data, d->size);
+  for(i = 0; i < d->size / BSIZE; i++)
+    setbn(din, i, start + i);
+  din->size = xint(d->size);
+  free(d->data);
+}
+
+// Add the tree under host directory path to directory d.
+void
+addtree(struct dirbuf *d, char *path)
+{
+  hostdirent **ents;
+  struct dirbuf sub;
+  struct stat st;
+  char *p;
+  int i, n;
+
+  if((n = scandir(path, &ents, 0, alphasort)) < 0)
+    die("%s: cannot read directory", path);
+  for(i = 0; i < n; i++){
+    if(strcmp(ents[i]->d_name, ".") == 0 || strcmp(ents[i]->d_name, "..") == 0){
+      free(ents[i]);
+      continue;
+    }
+    if((p = malloc(strlen(path) + 1 + strlen(ents[i]->d_name) + 1)) == 0)
+      die("out of memory");
+    sprintf(p, "%s/%s", path, ents[i]->d_name);
+    if(stat(p, &st) < 0)
+      die("%s: cannot stat", p);
+    if(S_ISDIR(st.st_mode)){
+      dirinit(&sub, d);
+      addtree(&sub, p);
+      dirfinish(&sub);
+      dirappend(d, ents[i]->d_name, sub.inum);
+    } else if(S_ISREG(st.st_mode)){
+      dirappend(d, ents[i]->d_name, addfile(p, st.st_size));
+    } else {
+      fprintf(stderr, "mkfs: %s: skipped, not a file or directory\n", p);
+    }
+    free(p);
+    free(ents[i]);
+  }
+  free(ents);
+}
+
+// Write the superblock, in disk byte order.
+void
+wsb(void)
+{
+  struct superblock *dsb = (struct superblock*)block(1);
+
+  dsb->magic = xint(sb.magic);
+  dsb->size = xint(sb.size);
+  dsb->nblocks = xint(sb.nblocks);
+  dsb->ninodes = xint(sb.ninodes);
+  dsb->nlog = xint(sb.nlog);
+  dsb->logstart = xint(sb.logstart);
+  dsb->inodestart = xint(sb.inodestart);
+  dsb->bmapstart = xint(sb.bmapstart);
+  dsb->bsize = xint(sb.bsize);
+}
+
+// Thread: read files into the image until none are left.
+void*
+copier(void *arg)
+{
+  struct job *j;
+  int fd, i;
+  uint n;
+  ssize_t cc;
+
+  while((i = __sync_fetch_and_add(&nextjob, 1)) < njob){
+    j = &jobs[i];
+    if((fd = open(j->path, O_RDONLY)) < 0)
+      die("%s: cannot open", j->path);
+    for(n = 0; n < j->size; n += cc){
+      cc = read(fd, j->dst + n, j->size - n);
+      if(cc <= 0)
+        die("%s: read failed, or file shrank", j->path);
+    }
+    close(fd);
+  }
+  return 0;
+}
+
+void
+usage(void)
+{
+  fprintf(stderr, "usage: mkfs [-s blocks] [-i inodes] [-l logblocks] "
+          "[-j threads] [-d dir] fs.img [files...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint size = FSSIZE, ninodes = NINODES, nlog = LOGSIZE;
+  uint nbitmap, ninodeblocks, nmeta, b;
+  int i, c, fd, nthread = 0;
+  char *tree = 0, *shortname;
+  pthread_t th[MAXTHREADS];
+  struct dirbuf root;
+  struct stat st;
+
+  static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
+  static_assert(BSIZE % sizeof(struct dinode) == 0, "dinodes must fill blocks");
+
+  while((c = getopt(argc, argv, "s:i:l:j:d:")) != -1){
+    switch(c){
+    case 's': size = atoi(optarg); break;
+    case 'i': ninodes = atoi(optarg); break;
+    case 'l': nlog = atoi(optarg); break;
+    case 'j': nthread = atoi(optarg); break;
+    case 'd': tree = optarg; break;
+    default: usage();
+    }
+  }
+  if(optind >= argc)
+    usage();
+
+  // Each of the kernel's two log regions needs a header block
+  // and room for the biggest operation, and can use no more
+  // blocks than its header can name.
+  if(nlog / 2 < MAXOPBLOCKS + 1)
+    die("log must have at least %d blocks", 2 * (MAXOPBLOCKS + 1));
+  if(nlog / 2 - 1 > LOGHDRMAX)
+    die("log must have at most %d blocks", 2 * (int)(LOGHDRMAX + 1));
+  // directory entries hold 16-bit inode numbers.
+  if(ninodes < 2 || ninodes > 0xffff)
+    die("inodes must be between 2 and %d", 0xffff);
+
+  nbitmap = size / BPB + 1;
+  ninodeblocks = ninodes / IPB + 1;
+  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  if(size <= nmeta)
+    die("size %u leaves no room for data", size);
+
+  sb.magic = FSMAGIC;
+  sb.size = size;
+  sb.nblocks = size - nmeta;
+  sb.ninodes = ninodes;
+  sb.nlog = nlog;
+  sb.logstart = 2;
+  sb.inodestart = 2 + nlog;
+  sb.bmapstart = 2 + nlog + ninodeblocks;
+  sb.bsize = BSIZE;
+
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, size - nmeta, size);
+
+  fd = open(argv[optind], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  if(fd < 0)
+    die("%s: cannot create", argv[optind]);
+  if(ftruncate(fd, (off_t)size * BSIZE) < 0)
+    die("%s: cannot make it %u blocks", argv[optind], size);
+  img = mmap(0, (size_t)size * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(img == MAP_FAILED)
+    die("%s: cannot map", argv[optind]);
+
+  freeblock = nmeta;
+
+  dirinit(&root, 0);
+  if(root.inum != ROOTINO)
+    die("root is inode %u", root.inum);
+
+  for(i = optind + 1; i < argc; i++){
+    // get rid of "user/"
+    if(strncmp(argv[i], "user/", 5) == 0)
+      shortname = argv[i] + 5;
+    else
+      shortname = argv[i];
+    if(strchr(shortname, '/') != 0)
+      die("%s: name has a /", shortname);
+
+    // Skip leading _ in name when writing to file system.
+    // The binaries are named _rm, _cat, etc. to keep the
+    // build operating system from trying to execute them
+    // in place of system binaries like rm and cat.
+    if(shortname[0] == '_')
+      shortname += 1;
+
+    if(stat(argv[i], &st) < 0 || !S_ISREG(st.st_mode))
+      die("%s: not a file", argv[i]);
+    dirappend(&root, shortname, addfile(argv[i], st.st_size));
+  }
+  if(tree)
+    addtree(&root, tree);
+  dirfinish(&root);
+
+  wsb();
+
+  // Everything below freeblock is in use.
+  for(b = 0; b < freeblock; b++)
+    block(BBLOCK(b, sb))[(b % BPB) / 8] |= 1 << (b % 8);
+
+  // Fill in the files.
+  if(nthread <= 0)
+    nthread = sysconf(_SC_NPROCESSORS_ONLN);
+  if(nthread > njob)
+    nthread = njob;
+  if(nthread > MAXTHREADS)
+    nthread = MAXTHREADS;
+  for(i = 0; i < nthread; i++)
+    if(pthread_create(&th[i], 0, copier, 0) != 0)
+      die("cannot start thread");
+  for(i = 0; i < nthread; i++)
+    pthread_join(th[i], 0);
+
+  printf("%d files, %u of %u blocks used, %u inodes\n",
+         njob, freeblock, size, freeinode - 1);
+
+  if(munmap(img, (size_t)size * BSIZE) < 0 || close(fd) < 0)
+    die("%s: write failed", argv[optind]);
+  return 0;
+}
@@ -0,0 +1,44 @@
+// bcstat: show buffer cache statistics, and optionally resize it.
+//
+// usage: bcstat [-s nbuf]
+//   -s  limit the cache to nbuf buffers first; the cache shrinks
+//       right away if it is bigger, and otherwise grows on demand
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/bcache_stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat st;
+  uint64 total;
+  int i;
+
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-s") == 0 && i + 1 < argc){
+      printf("bcstat: limit set to %d buffers\n", bcachesize(atoi(argv[++i])));
+    } else {
+      fprintf(2, "usage: bcstat [-s nbuf]\n");
+      exit(1);
+    }
+  }
+
+  if(bcachestat(&st) < 0){
+    fprintf(2, "bcstat: bcachestat failed\n");
+    exit(1);
+  }
+
+  total = st.hits + st.misses;
+  printf("size:      %d buffers (%d KB), min %d, max %d\n",
+         st.nbuf, st.nbuf * st.bsize / 1024, st.min, st.max);
+  printf("lookups:   %lu\n", total);
+  printf("hits:      %lu (%lu%%)\n", st.hits, total ? st.hits * 100 / total : 0);
+  printf("misses:    %lu\n", st.misses);
+  printf("evictions: %lu\n", st.evictions);
+  printf("readahead: %lu blocks\n", st.readaheads);
+  printf("grown:     %lu pages\n", st.grows);
+  printf("shrunk:    %lu pages\n", st.shrinks);
+  exit(0);
+}
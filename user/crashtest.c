@@ -0,0 +1,318 @@
+// crashtest: check that the file system recovers from a crash.
+//
+// usage: crashtest name
+//
+// The first run of a test sets up its files, arranges with
+// logcrash() for the system to crash part way through a commit,
+// and does the updates that the crash interrupts. Boot again and
+// run the same command: it checks that what was committed before
+// the crash is intact, and cleans up.
+//
+//   freereuse  unlink a file and, in the same transaction, write a
+//              new one into the blocks it freed
+//   rmwrite    remove a directory and its files, as rm -r would,
+//              then write a file into the freed blocks before the
+//              delayed commit
+//   orphan     crash with a big file unlinked but still open; boot
+//              must free its blocks
+//   torn       crash with a commit half written to the log; its
+//              checksum must keep recovery from installing it
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NBLK (NDIRECT + 2)  // blocks in a test file: some indirect
+#define NFILE 10            // files in rmwrite's directory
+
+char buf[BSIZE];
+
+void
+fail(char *msg)
+{
+  printf("crashtest: %s\n", msg);
+  exit(1);
+}
+
+// Write the file path, n blocks, block i filled with c + i.
+void
+writefile(char *path, int n, int c)
+{
+  int fd, i;
+
+  if((fd = open(path, O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+    fail("create failed");
+  for(i = 0; i < n; i++){
+    memset(buf, c + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE)
+      fail("write failed");
+  }
+  close(fd);
+}
+
+// Is the file path n blocks, block i filled with c + i?
+int
+checkfile(char *path, int n, int c)
+{
+  int fd, i, j, ok;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return 0;
+  ok = 1;
+  for(i = 0; ok && i < n; i++){
+    if(read(fd, buf, BSIZE) != BSIZE)
+      ok = 0;
+    for(j = 0; ok && j < BSIZE; j++)
+      if(buf[j] != (char)(c + i))
+        ok = 0;
+  }
+  if(ok && read(fd, buf, 1) != 0)
+    ok = 0;
+  close(fd);
+  return ok;
+}
+
+// Commit everything so far, and then enough small transactions
+// that neither log region still holds it, so that it is all at
+// its home locations and nothing but the revoke table stands
+// between a freed block and an early write of new data over it.
+void
+settle(char *mark)
+{
+  int fd, i;
+
+  for(i = 0; i < 3; i++){
+    if((fd = open(mark, O_CREATE|O_WRONLY)) < 0)
+      fail("cannot write mark");
+    write(fd, &i, sizeof(i));
+    if(fsync(fd) < 0)
+      fail("fsync failed");
+    close(fd);
+  }
+}
+
+// Use up all free blocks, so that the next writes must take
+// blocks freed after this. Returns how many that took.
+int
+filldisk(void)
+{
+  int fd, n;
+
+  if((fd = open("ctfill", O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+    fail("cannot create ctfill");
+  memset(buf, 'f', BSIZE);
+  for(n = 0; write(fd, buf, BSIZE) == BSIZE; n++)
+    ;
+  close(fd);
+  return n;
+}
+
+// Crash in the commit of the transaction that is open now, while
+// fd is written. Does not return if the crash happens.
+void
+crash(int fd)
+{
+  if(fsync(fd) < 0)
+    fail("fsync failed");
+  fail("did not crash");
+}
+
+void
+freereuse(char *mark)
+{
+  int fd;
+
+  writefile("ctold", NBLK, 'a');
+  filldisk();
+  settle(mark);
+
+  if(logcrash(1, 0) < 0)
+    fail("logcrash failed");
+  unlink("ctold");
+  writefile("ctnew", NBLK, 'A');
+  if((fd = open("ctnew", O_RDONLY)) < 0)
+    fail("cannot open ctnew");
+  crash(fd);
+}
+
+void
+freereuse_check(void)
+{
+  int ok;
+
+  ok = checkfile("ctold", NBLK, 'a');
+  unlink("ctold");
+  unlink("ctnew");
+  unlink("ctfill");
+  if(!ok)
+    fail("freereuse: ctold is damaged");
+}
+
+void
+rmwrite(char *mark)
+{
+  char name[16];
+  int fd, i;
+
+  if(mkdir("ctdir") < 0)
+    fail("mkdir failed");
+  for(i = 0; i < NFILE; i++){
+    strcpy(name, "ctdir/f0");
+    name[7] = '0' + i;
+    writefile(name, 1, 'a' + i);
+  }
+  filldisk();
+  settle(mark);
+
+  if(logcrash(1, 0) < 0)
+    fail("logcrash failed");
+  for(i = 0; i < NFILE; i++){
+    strcpy(name, "ctdir/f0");
+    name[7] = '0' + i;
+    unlink(name);
+  }
+  unlink("ctdir");
+  writefile("ctnew", NFILE, 'A');
+  if((fd = open("ctnew", O_RDONLY)) < 0)
+    fail("cannot open ctnew");
+  crash(fd);
+}
+
+void
+rmwrite_check(void)
+{
+  char name[16];
+  int ok, i;
+
+  ok = 1;
+  for(i = 0; i < NFILE; i++){
+    strcpy(name, "ctdir/f0");
+    name[7] = '0' + i;
+    if(!checkfile(name, 1, 'a' + i))
+      ok = 0;
+    unlink(name);
+  }
+  unlink("ctdir");
+  unlink("ctnew");
+  unlink("ctfill");
+  if(!ok)
+    fail("rmwrite: ctdir is damaged");
+}
+
+void
+orphan(char *mark)
+{
+  int fd, n;
+
+  // the free block count, before ctbig.
+  n = filldisk();
+  unlink("ctfill");
+  if((fd = open("ctn", O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+    fail("cannot create ctn");
+  write(fd, &n, sizeof(n));
+  close(fd);
+
+  writefile("ctbig", 4*NBLK, 'a');
+  if((fd = open("ctbig", O_RDONLY)) < 0)
+    fail("cannot open ctbig");
+  unlink("ctbig");
+  settle(mark);
+
+  if(logcrash(1, 0) < 0)
+    fail("logcrash failed");
+  writefile("ctnew", 1, 'A');
+  crash(fd);
+}
+
+void
+orphan_check(void)
+{
+  int fd, n, n1;
+
+  if((fd = open("ctn", O_RDONLY)) < 0 || read(fd, &n, sizeof(n)) != sizeof(n))
+    fail("orphan: cannot read ctn");
+  close(fd);
+  n1 = filldisk();
+  unlink("ctfill");
+  unlink("ctnew");
+  unlink("ctn");
+  // a block or two may have gone to directory entries.
+  if(n1 < n - 2)
+    fail("orphan: ctbig's blocks were not freed");
+}
+
+void
+torn(char *mark)
+{
+  int fd;
+
+  writefile("ctold", NBLK, 'a');
+  settle(mark);
+
+  if(logcrash(1, 1) < 0)
+    fail("logcrash failed");
+  unlink("ctold");
+  if(mkdir("ctdir") < 0)
+    fail("mkdir failed");
+  writefile("ctdir/f", 1, 'A');
+  if((fd = open("ctdir", O_RDONLY)) < 0)
+    fail("cannot open ctdir");
+  crash(fd);
+}
+
+void
+torn_check(void)
+{
+  struct stat st;
+  int ok;
+
+  ok = checkfile("ctold", NBLK, 'a') && stat("ctdir", &st) < 0;
+  unlink("ctdir/f");
+  unlink("ctdir");
+  unlink("ctold");
+  if(!ok)
+    fail("torn: recovery installed part of a commit");
+}
+
+struct test {
+  char *name;
+  void (*setup)(char *mark);
+  void (*check)(void);
+} tests[] = {
+  { "freereuse", freereuse, freereuse_check },
+  { "rmwrite", rmwrite, rmwrite_check },
+  { "orphan", orphan, orphan_check },
+  { "torn", torn, torn_check },
+  { 0, 0, 0 },
+};
+
+int
+main(int argc, char *argv[])
+{
+  struct test *t;
+  struct stat st;
+  char mark[32];
+
+  if(argc != 2)
+    fail("usage: crashtest name");
+  for(t = tests; t->name; t++)
+    if(strcmp(t->name, argv[1]) == 0)
+      break;
+  if(t->name == 0)
+    fail("no such test");
+
+  // The mark file says the setup ran, and the system crashed.
+  strcpy(mark, "ct.");
+  strcpy(mark + 3, t->name);
+  if(stat(mark, &st) == 0){
+    t->check();
+    unlink(mark);
+    printf("crashtest %s: OK\n", t->name);
+    exit(0);
+  }
+  printf("crashtest %s: crashing; boot again and rerun\n", t->name);
+  t->setup(mark);
+  exit(1);
+}
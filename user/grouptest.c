@@ -5,6 +5,9 @@
 
 #define NUM_PROCESSES 4
 #define LOCK_ID_CONTENTION 34
+#define LOCK_ID_FAST_PATH 35
+#define NAMESPACE_BASE_KEY 100000
+#define NAMESPACE_LOCKS 300  // more than the old fixed table of 64
 #define INCREMENTS_PER_PROCESS_CONTENTION 100
 #define COUNTER_FILE "counter.txt"
 
@@ -345,6 +348,129 @@ void test_lock_contention(void) {
     unlink(COUNTER_FILE); // Delete the test file
 }
 
+// Same shared-counter test, but through the user-space fast path:
+// grouplock_open() maps the lock word, and uncontended
+// acquire/release never enter the kernel.
+void test_user_fast_path(void) {
+    printf("\n=== GroupLock User-space Fast Path Test ===\n");
+
+    if (grouplock_create(LOCK_ID_FAST_PATH, "fast_lock") < 0) {
+        printf("✗ Failed to create fast path lock\n");
+        tests_failed++;
+        return;
+    }
+
+    struct grouplock_shared *gl = grouplock_open(LOCK_ID_FAST_PATH);
+    TEST_ASSERT(gl != 0, "Mapped grouplock state page into user space");
+    if (gl == 0) {
+        grouplock_destroy(LOCK_ID_FAST_PATH);
+        return;
+    }
+
+    TEST_ASSERT(grouplock_lock(gl) == 0, "Uncontended acquire on fast path (0 + 1 = 1)");
+    TEST_ASSERT(grouplock_unlock(gl) == 0, "Uncontended release on fast path (1 + 1 = 0)");
+    TEST_ASSERT(grouplock_unlock(gl) < 0, "Correctly rejected repeated fast path release");
+
+    // Another lock's word must not share the page
+    if (grouplock_create(LOCK_ID_FAST_PATH + 1, "fast_lock2") == 0) {
+        struct grouplock_shared *gl2 = grouplock_open(LOCK_ID_FAST_PATH + 1);
+        TEST_ASSERT(gl2 != 0 && (uint64)gl / 4096 != (uint64)gl2 / 4096,
+                    "Each lock word has a page of its own");
+        grouplock_destroy(LOCK_ID_FAST_PATH + 1);
+    }
+
+    // A fast path holder is unknown to the kernel, so nobody may
+    // release the lock through the syscall
+    grouplock_lock(gl);
+    int pid = fork();
+    if (pid == 0) {
+        exit(grouplock_release(LOCK_ID_FAST_PATH) == -3 ? 0 : 1);
+    }
+    int status = -1;
+    wait(&status);
+    TEST_ASSERT(status == 0, "Correctly rejected release of a fast path lock by another process");
+    TEST_ASSERT(grouplock_release(LOCK_ID_FAST_PATH) == -3, "Correctly rejected syscall release of a fast path lock");
+    TEST_ASSERT(grouplock_unlock(gl) == 0, "Fast path holder released its lock");
+
+    write_counter(COUNTER_FILE, 0);
+
+    for (int i = 0; i < NUM_PROCESSES; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("✗ Fork failed\n");
+            break;
+        }
+        if (pid == 0) {
+            // The mapping is inherited across fork
+            for (int j = 0; j < INCREMENTS_PER_PROCESS_CONTENTION; j++) {
+                grouplock_lock(gl);
+                int current_val = read_counter(COUNTER_FILE);
+                if (current_val != -1) {
+                    write_counter(COUNTER_FILE, current_val + 1);
+                }
+                grouplock_unlock(gl);
+            }
+            exit(0);
+        }
+    }
+
+    for (int i = 0; i < NUM_PROCESSES; i++) {
+        wait(0);
+    }
+
+    int final_val = read_counter(COUNTER_FILE);
+    int expected_val = NUM_PROCESSES * INCREMENTS_PER_PROCESS_CONTENTION;
+
+    printf("Final counter value in file: %d\n", final_val);
+    printf("Expected value: %d\n", expected_val);
+
+    TEST_ASSERT(final_val == expected_val, "Fast path lock correctly prevented race conditions");
+
+    grouplock_destroy(LOCK_ID_FAST_PATH);
+    unlink(COUNTER_FILE);
+}
+
+// Test the dynamic lock namespace: many locks with sparse 64-bit keys,
+// and named locks looked up through grouplock_get()
+void test_dynamic_namespace(void) {
+    printf("\n=== Dynamic Lock Namespace Test ===\n");
+
+    int created = 0;
+    for (int i = 0; i < NAMESPACE_LOCKS; i++) {
+        if (grouplock_create(NAMESPACE_BASE_KEY + i * 7919, "ns_lock") == 0) {
+            created++;
+        }
+    }
+    TEST_ASSERT(created == NAMESPACE_LOCKS, "Created more locks than the old fixed table allowed");
+
+    int ok = 1;
+    for (int i = 0; i < NAMESPACE_LOCKS; i += 37) {
+        uint64 key = NAMESPACE_BASE_KEY + i * 7919;
+        if (grouplock_acquire(key) != 0 || grouplock_release(key) != 0) {
+            ok = 0;
+        }
+    }
+    TEST_ASSERT(ok, "Acquire/release works on locks found by hashed key");
+
+    int destroyed = 0;
+    for (int i = 0; i < NAMESPACE_LOCKS; i++) {
+        if (grouplock_destroy(NAMESPACE_BASE_KEY + i * 7919) == 0) {
+            destroyed++;
+        }
+    }
+    TEST_ASSERT(destroyed == NAMESPACE_LOCKS, "Destroyed all namespace locks");
+
+    uint64 k1 = grouplock_get("named_lock");
+    uint64 k2 = grouplock_get("named_lock");
+    uint64 k3 = grouplock_get("other_lock");
+    TEST_ASSERT(k1 != 0 && k1 == k2, "Named lookup returns the same lock");
+    TEST_ASSERT(k3 != 0 && k3 != k1, "Different names give different locks");
+    TEST_ASSERT(grouplock_acquire(k1) == 0 && grouplock_release(k1) == 0,
+                "Named lock can be acquired and released");
+    grouplock_destroy(k1);
+    grouplock_destroy(k3);
+}
+
 //Test some cases like invalid ID, repeated operations, destroying a lock in use
 void test_edge_cases(void) {
     printf("\n=== Edge Cases Test ===\n");
@@ -398,6 +524,8 @@ int main(int argc, char *argv[]) {
     test_multiple_processes();
     test_edge_cases();
     test_lock_contention();
+    test_user_fast_path();
+    test_dynamic_namespace();
     
     // Test results summary
     printf("=== Test Results Summary ===\n");
@@ -0,0 +1,34 @@
+// icstat: show inode table statistics.
+//
+// usage: icstat
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/icache_stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct icachestat st;
+  uint64 total;
+
+  if(argc != 1){
+    fprintf(2, "usage: icstat\n");
+    exit(1);
+  }
+
+  if(icachestat(&st) < 0){
+    fprintf(2, "icstat: icachestat failed\n");
+    exit(1);
+  }
+
+  total = st.hits + st.misses;
+  printf("size:      %d inodes, min %d, max %d\n", st.ninode, st.min, st.max);
+  printf("lookups:   %lu\n", total);
+  printf("hits:      %lu (%lu%%)\n", st.hits, total ? st.hits * 100 / total : 0);
+  printf("misses:    %lu\n", st.misses);
+  printf("evictions: %lu\n", st.evictions);
+  printf("grown:     %lu pages\n", st.grows);
+  exit(0);
+}
@@ -0,0 +1,90 @@
+// lockstat: dump the most contended grouplocks.
+//
+// usage: lockstat [-n count] [-v]
+//   -n  show at most count locks (default 10)
+//   -v  also print the wait and hold time histograms
+//
+// Times are in time-CSR cycles (10 MHz on qemu, i.e. 100ns each).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/grouplock_shared.h"
+#include "user/user.h"
+
+static void
+printhist(char *what, uint *hist)
+{
+  int i, lo, hi;
+
+  // skip empty buckets at both ends
+  for(lo = 0; lo < GL_NHIST && hist[lo] == 0; lo++)
+    ;
+  for(hi = GL_NHIST - 1; hi >= lo && hist[hi] == 0; hi--)
+    ;
+  if(lo > hi)
+    return;
+  printf("    %s:\n", what);
+  for(i = lo; i <= hi; i++){
+    if(i == GL_NHIST - 1)
+      printf("      >= %lu: %d\n", 1UL << i, hist[i]);
+    else
+      printf("      %lu-%lu: %d\n", 1UL << i, (1UL << (i+1)) - 1, hist[i]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct grouplock_stat *st, tmp;
+  int i, j, n, count = 10, verbose = 0;
+
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-n") == 0 && i + 1 < argc){
+      count = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-v") == 0){
+      verbose = 1;
+    } else {
+      fprintf(2, "usage: lockstat [-n count] [-v]\n");
+      exit(1);
+    }
+  }
+
+  // all of them, so the sort sees every lock.
+  st = malloc(NGROUPLOCK * sizeof(*st));
+  if(st == 0){
+    fprintf(2, "lockstat: out of memory\n");
+    exit(1);
+  }
+  if((n = grouplock_stats(st, NGROUPLOCK)) < 0){
+    fprintf(2, "lockstat: grouplock_stats failed\n");
+    exit(1);
+  }
+
+  // sort by contended acquisitions, then by total wait time
+  for(i = 1; i < n; i++){
+    tmp = st[i];
+    for(j = i; j > 0 && (st[j-1].contended < tmp.contended ||
+        (st[j-1].contended == tmp.contended && st[j-1].wait_total < tmp.wait_total)); j--)
+      st[j] = st[j-1];
+    st[j] = tmp;
+  }
+
+  printf("%d grouplocks\n", n);
+  printf("key                 name             acquires  contended  avg wait  avg hold\n");
+  for(i = 0; i < n && i < count; i++){
+    printf("%lx  %s", st[i].key, st[i].name);
+    for(j = strlen(st[i].name); j < 16; j++)
+      printf(" ");
+    printf(" %d  %d  %lu  %lu\n", st[i].acquires, st[i].contended,
+           st[i].contended ? st[i].wait_total / st[i].contended : 0,
+           st[i].hold_samples ? st[i].hold_total / st[i].hold_samples : 0);
+    if(verbose){
+      printhist("wait", st[i].wait_hist);
+      printhist("hold", st[i].hold_hist);
+    }
+  }
+
+  free(st);
+  exit(0);
+}
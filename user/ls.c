@@ -4,10 +4,12 @@
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
 
+#define NAMEW 14  // names are padded to this width
+
 char*
 fmtname(char *path)
 {
-  static char buf[DIRSIZ+1];
+  static char buf[NAMEW+1];
   char *p;
 
   // Find first character after last slash.
@@ -16,10 +18,10 @@ fmtname(char *path)
   p++;
 
   // Return blank-padded name.
-  if(strlen(p) >= DIRSIZ)
+  if(strlen(p) >= NAMEW)
     return p;
   memmove(buf, p, strlen(p));
-  memset(buf+strlen(p), ' ', DIRSIZ-strlen(p));
+  memset(buf+strlen(p), ' ', NAMEW-strlen(p));
   return buf;
 }
 
@@ -27,8 +29,9 @@ void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  static char blk[BSIZE];
+  int fd, o;
+  struct dirent *de;
   struct stat st;
 
   if((fd = open(path, O_RDONLY)) < 0){
@@ -56,16 +59,22 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
+    // directory records do not cross blocks.
+    while(read(fd, blk, sizeof(blk)) == sizeof(blk)){
+      for(o = 0; o < sizeof(blk); o += de->reclen){
+        de = (struct dirent*)(blk + o);
+        if(de->reclen == 0)
+          break;
+        if(de->inum == 0)
+          continue;
+        memmove(p, de->name, de->namelen);
+        p[de->namelen] = 0;
+        if(stat(buf, &st) < 0){
+          printf("ls: cannot stat %s\n", buf);
+          continue;
+        }
+        printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, (int) st.size);
       }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, (int) st.size);
     }
     break;
   }
@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/grouplock_shared.h"
 #include "user/user.h"
 
 //
@@ -145,3 +146,47 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+// Grouplock fast path on the lock word returned by grouplock_open().
+// The uncontended acquire is one CAS (0 + 1 = 1); only when the lock
+// is held do we trap into the kernel to sleep.
+int
+grouplock_lock(struct grouplock_shared *gl)
+{
+  if(__sync_bool_compare_and_swap(&gl->state, GROUP_ELEM_0, GROUP_ELEM_1)){
+    // we own the word now, so plain stores are enough.
+    gl->holder_pid = 0;
+    gl->acquired_at = rdtime();
+    gl->acquires++;
+    return 0;
+  }
+  return grouplock_acquire(gl->key);
+}
+
+// Release is the inverse operation 1 + 1 = 0 done in user space.
+// Waiters increment gl->waiters before their final CAS, so seeing
+// zero here after the state is back to 0 means nobody can be asleep.
+int
+grouplock_unlock(struct grouplock_shared *gl)
+{
+  uint64 hold;
+
+  if(gl->state != GROUP_ELEM_1)
+    return -3;
+  hold = rdtime() - gl->acquired_at;
+  gl->holder_pid = -1;
+  __sync_synchronize();
+  __sync_lock_release(&gl->state);
+  __sync_synchronize();
+  if(gl->waiters != 0)
+    return grouplock_wake(gl->key, hold);
+  return 0;
+}
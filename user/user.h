@@ -1,4 +1,8 @@
 struct stat;
+struct grouplock_shared;
+struct grouplock_stat;
+struct bcachestat;
+struct icachestat;
 
 // system calls
 int fork(void);
@@ -25,12 +29,22 @@ int uptime(void);
 int freemem(void);
 int pgtableinfo(void);
 
-int grouplock_create(int group_id, char *name);
-int grouplock_acquire(int group_id);
-int grouplock_release(int group_id);
-int grouplock_destroy(int group_id);
+int grouplock_create(uint64 key, char *name);
+int grouplock_acquire(uint64 key);
+int grouplock_release(uint64 key);
+int grouplock_destroy(uint64 key);
 int grouplock_verify(void);
-int grouplock_debug(int group_id);
+int grouplock_debug(uint64 key);
+struct grouplock_shared* grouplock_open(uint64 key);
+int grouplock_wake(uint64 key, uint64 hold);
+uint64 grouplock_get(char *name);
+int grouplock_stats(struct grouplock_stat*, int max);
+int bcachestat(struct bcachestat*);
+int bcachesize(int);
+int fsync(int);
+int icachestat(struct icachestat*);
+int logcrash(int, int);
+int fbmap(int, int);
 
 
 // ulib.c
@@ -47,6 +61,8 @@ void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int grouplock_lock(struct grouplock_shared*);
+int grouplock_unlock(struct grouplock_shared*);
 
 // umalloc.c
 void* malloc(uint);
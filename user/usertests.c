@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/icache_stat.h"
+#include "kernel/bcache_stat.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -578,10 +580,757 @@ writetest(char *s)
   }
 }
 
+// fsync() must commit a write and reject a bad descriptor.
+void
+fsynctest(char *s)
+{
+  int fd;
+
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat fsyncf failed!\n", s);
+    exit(1);
+  }
+  if(write(fd, "aaaaaaaaaa", 10) != 10){
+    printf("%s: error: write fsyncf failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(unlink("fsyncf") < 0){
+    printf("%s: unlink fsyncf failed\n", s);
+    exit(1);
+  }
+}
+
+// small files live in the inode until they grow past NINLINE.
+void
+inlinetest(char *s)
+{
+  enum { BIG = BSIZE + NINLINE };
+  static char buf[BIG];
+  int fd, i, n;
+
+  for(i = 0; i < BIG; i++)
+    buf[i] = 'a' + i % 26;
+  fd = open("inlinef", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat inlinef failed!\n", s);
+    exit(1);
+  }
+  // fill the inode in two writes, then grow out of it.
+  if(write(fd, buf, 10) != 10 || write(fd, buf + 10, NINLINE - 10) != NINLINE - 10){
+    printf("%s: error: write inlinef failed\n", s);
+    exit(1);
+  }
+  if(write(fd, buf + NINLINE, BIG - NINLINE) != BIG - NINLINE){
+    printf("%s: error: write past NINLINE failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("inlinef", O_RDONLY);
+  memset(buf, 0, BIG);
+  if((n = read(fd, buf, BIG)) != BIG){
+    printf("%s: read inlinef got %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < BIG; i++){
+    if(buf[i] != 'a' + i % 26){
+      printf("%s: inlinef wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  // truncated, it is small again.
+  fd = open("inlinef", O_TRUNC|O_RDWR);
+  if(write(fd, "xyz", 3) != 3){
+    printf("%s: error: write truncated inlinef failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inlinef", O_RDONLY);
+  if(read(fd, buf, BIG) != 3 || buf[0] != 'x' || buf[2] != 'z'){
+    printf("%s: truncated inlinef wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("inlinef") < 0){
+    printf("%s: unlink inlinef failed\n", s);
+    exit(1);
+  }
+}
+
+// a file written block after block should get blocks that are
+// contiguous on disk, whether in big writes or small appends.
+void
+alloclocal(char *s)
+{
+  enum { NBLK = 2*NDIRECT };
+  int fd, i, breaks;
+  int addr[NBLK];
+
+  unlink("localf");
+  fd = open("localf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat localf failed!\n", s);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1 || fbmap(fd, 0) != 0){
+    printf("%s: inline localf has a block\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // the first half in one write, the rest a block at a time.
+  fd = open("localf", O_TRUNC|O_RDWR);
+  memset(buf, 'l', BSIZE * (NBLK/2));
+  if(write(fd, buf, BSIZE * (NBLK/2)) != BSIZE * (NBLK/2)){
+    printf("%s: error: write localf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = NBLK/2; i < NBLK; i++){
+    fd = open("localf", O_RDWR);
+    if(fd < 0 || read(fd, buf, BSIZE * i) != BSIZE * i){
+      printf("%s: reopen localf failed\n", s);
+      exit(1);
+    }
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: error: append localf failed\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  fd = open("localf", O_RDONLY);
+  for(i = 0; i < NBLK; i++){
+    if((addr[i] = fbmap(fd, i)) <= 0){
+      printf("%s: localf block %d has no address\n", s, i);
+      exit(1);
+    }
+  }
+  if(fbmap(fd, NBLK) != 0){
+    printf("%s: localf has a block past its end\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // the indirect block comes between, and the disk may be
+  // fragmented by earlier tests; but only a little.
+  breaks = 0;
+  for(i = 1; i < NBLK; i++)
+    if(addr[i] != addr[i-1] + 1)
+      breaks++;
+  if(breaks > 4){
+    printf("%s: localf is in %d pieces\n", s, breaks + 1);
+    exit(1);
+  }
+  unlink("localf");
+}
+
+// write nblk blocks to the file name, each int in it set to
+// seed plus its index in the file, so that a block read from
+// the wrong place, or a part of one, shows.
+void
+tagfile(char *s, char *name, int nblk, int seed)
+{
+  int fd, i, j;
+  int *w = (int*)buf;
+
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("%s: create %s failed\n", s, name);
+    exit(1);
+  }
+  for(i = 0; i < nblk; i++){
+    for(j = 0; j < BSIZE/sizeof(int); j++)
+      w[j] = seed + i*(BSIZE/sizeof(int)) + j;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// check a file written by tagfile(), reading n bytes at a time.
+void
+checktag(char *s, char *name, int nblk, int seed, int n)
+{
+  int fd, i, cc, tot;
+  int *w = (int*)buf;
+
+  fd = open(name, O_RDONLY);
+  if(fd < 0){
+    printf("%s: open %s failed\n", s, name);
+    exit(1);
+  }
+  tot = 0;
+  while((cc = read(fd, buf, n)) > 0){
+    for(i = 0; i < cc/sizeof(int); i++){
+      if(w[i] != seed + tot/sizeof(int) + i){
+        printf("%s: %s wrong at byte %d\n", s, name, tot + i*(int)sizeof(int));
+        exit(1);
+      }
+    }
+    tot += cc;
+  }
+  close(fd);
+  if(tot != nblk*BSIZE){
+    printf("%s: read %d bytes of %s, not %d\n", s, tot, name, nblk*BSIZE);
+    exit(1);
+  }
+}
+
+// processes working on different files at once, through the
+// buffer cache's separately locked buckets, must each see their
+// own blocks; and a block read again at once must be a hit.
+void
+bcachebuckets(char *s)
+{
+  enum { NCHILD = 4, NBLK = 8 };
+  struct bcachestat st0, st1;
+  char name[4];
+  int ci, i, pid, xstatus;
+
+  name[0] = 'b';
+  name[1] = 'k';
+  name[3] = '\0';
+  for(ci = 0; ci < NCHILD; ci++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[2] = '0' + ci;
+      tagfile(s, name, NBLK, ci << 20);
+      for(i = 0; i < 10; i++)
+        checktag(s, name, NBLK, ci << 20, BSIZE);
+      unlink(name);
+      exit(0);
+    }
+  }
+  for(ci = 0; ci < NCHILD; ci++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  tagfile(s, "bk", NBLK, 0);
+  checktag(s, "bk", NBLK, 0, BSIZE);
+  if(bcachestat(&st0) < 0){
+    printf("%s: bcachestat failed\n", s);
+    exit(1);
+  }
+  checktag(s, "bk", NBLK, 0, BSIZE);
+  bcachestat(&st1);
+  unlink("bk");
+  if(st1.hits - st0.hits < NBLK){
+    printf("%s: %d hits rereading %d blocks\n", s, (int)(st1.hits - st0.hits), NBLK);
+    exit(1);
+  }
+}
+
+// the buffer cache grows past its minimum while there is spare
+// memory, gives it back when a process needs it, and the file
+// it cached stays intact through both.
+void
+bcachegrow(char *s)
+{
+  enum { NBLK = 3*NBUF };
+  struct bcachestat st0, st1, st2;
+  int pid, xstatus;
+  uint64 a;
+
+  if(bcachestat(&st0) < 0){
+    printf("%s: bcachestat failed\n", s);
+    exit(1);
+  }
+  bcachesize(4*NBUF);
+  tagfile(s, "bcgrow", NBLK, 7);
+  checktag(s, "bcgrow", NBLK, 7, BSIZE);
+  checktag(s, "bcgrow", NBLK, 7, BSIZE);
+  bcachestat(&st1);
+  if(st1.nbuf <= st1.min || st1.grows == st0.grows){
+    printf("%s: cache did not grow: %d buffers\n", s, st1.nbuf);
+    exit(1);
+  }
+
+  // allocate all of memory, which the cache must give up.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    while((a = (uint64)sbrk(PGSIZE)) != 0xffffffffffffffffLL)
+      *(char*)(a + PGSIZE - 1) = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  bcachestat(&st2);
+  bcachesize(st0.max);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(st2.shrinks == st1.shrinks){
+    printf("%s: cache did not shrink under memory pressure\n", s);
+    exit(1);
+  }
+
+  checktag(s, "bcgrow", NBLK, 7, BSIZE);
+  unlink("bcgrow");
+}
+
+// a sequential reader of a file that is not in the cache gets
+// blocks read ahead, and the right ones, even with another
+// reader going through the same file at once.
+void
+readahead(char *s)
+{
+  enum { NBLK = 2*NBUF + 4 };
+  struct bcachestat st0, st1;
+  int ci, pid, xstatus;
+
+  bcachestat(&st0);
+  tagfile(s, "rahead", NBLK, 3);
+  bcachesize(NBUF);
+
+  checktag(s, "rahead", NBLK, 3, BSIZE/2);
+  bcachestat(&st1);
+  if(st1.readaheads == st0.readaheads){
+    printf("%s: nothing was read ahead\n", s);
+    exit(1);
+  }
+
+  for(ci = 0; ci < 2; ci++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      // reads that straddle blocks, of different sizes.
+      checktag(s, "rahead", NBLK, 3, ci ? 1000 : 3*BSIZE/2);
+      exit(0);
+    }
+  }
+  for(ci = 0; ci < 2; ci++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  bcachesize(st0.max);
+  unlink("rahead");
+}
+
+// several processes reading and writing different files at once,
+// with a cache too small to hold them, keep many disk requests
+// in flight together; each must complete to the right buffer.
+void
+diskconc(char *s)
+{
+  enum { NCHILD = 4, NBLK = 16 };
+  struct bcachestat st;
+  char name[4];
+  int ci, i, pid, xstatus;
+
+  bcachestat(&st);
+  name[0] = 'd';
+  name[1] = 'c';
+  name[3] = '\0';
+  for(ci = 0; ci < NCHILD; ci++){
+    name[2] = '0' + ci;
+    tagfile(s, name, NBLK, ci << 20);
+  }
+  bcachesize(NBUF);
+
+  for(ci = 0; ci < NCHILD; ci++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[2] = '0' + ci;
+      for(i = 0; i < 4; i++){
+        if(ci % 2)
+          tagfile(s, name, NBLK, (ci << 20) + i);
+        checktag(s, name, NBLK, (ci << 20) + (ci % 2 ? i : 0), BSIZE);
+      }
+      exit(0);
+    }
+  }
+  for(ci = 0; ci < NCHILD; ci++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  bcachesize(st.max);
+  for(ci = 0; ci < NCHILD; ci++){
+    name[2] = '0' + ci;
+    unlink(name);
+  }
+}
+
+// a file laid out contiguously on disk is read back in runs of
+// blocks per disk request; each block of a run, and each sector
+// of a block, must land in its own place.
+void
+diskruns(char *s)
+{
+  enum { NBLK = 4*NDIRECT };
+  struct bcachestat st;
+  int fd, i, prev, addr, runs;
+
+  bcachestat(&st);
+  tagfile(s, "druns", NBLK, 11);
+
+  fd = open("druns", O_RDONLY);
+  prev = -1;
+  runs = 0;
+  for(i = 0; i < NBLK; i++){
+    addr = fbmap(fd, i);
+    if(addr == prev + 1)
+      runs++;
+    prev = addr;
+  }
+  close(fd);
+  if(runs < NBLK/2){
+    printf("%s: only %d of %d blocks follow the one before\n", s, runs, NBLK);
+    exit(1);
+  }
+
+  bcachesize(NBUF);
+  checktag(s, "druns", NBLK, 11, BUFSZ);
+  checktag(s, "druns", NBLK, 11, 512);
+  bcachesize(st.max);
+  unlink("druns");
+}
+
+// processes that fsync() at the same time share commits; each
+// must still find all it wrote there, and nothing else's.
+void
+groupcommit(char *s)
+{
+  enum { NCHILD = 4, NGC = 10 };
+  static char data[2*BSIZE];
+  char name[5];
+  int ci, i, fd, pid, xstatus, n;
+
+  name[0] = 'g';
+  name[1] = 'c';
+  name[4] = '\0';
+  for(ci = 0; ci < NCHILD; ci++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[2] = '0' + ci;
+      for(i = 0; i < NGC; i++){
+        name[3] = '0' + i;
+        fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+        if(fd < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+        // small files, and files with blocks of their own.
+        n = (i % 2) ? sizeof(data) : 10 + i;
+        memset(data, 'A' + ci*NGC + i, n);
+        if(write(fd, data, n) != n || fsync(fd) != 0){
+          printf("%s: write %s failed\n", s, name);
+          exit(1);
+        }
+        close(fd);
+      }
+      exit(0);
+    }
+  }
+  for(ci = 0; ci < NCHILD; ci++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  for(ci = 0; ci < NCHILD; ci++){
+    name[2] = '0' + ci;
+    for(i = 0; i < NGC; i++){
+      name[3] = '0' + i;
+      fd = open(name, O_RDONLY);
+      if(fd < 0){
+        printf("%s: %s is missing\n", s, name);
+        exit(1);
+      }
+      n = read(fd, data, sizeof(data));
+      close(fd);
+      if(n != ((i % 2) ? sizeof(data) : 10 + i) ||
+         data[0] != 'A' + ci*NGC + i || data[n-1] != 'A' + ci*NGC + i){
+        printf("%s: %s is wrong\n", s, name);
+        exit(1);
+      }
+      unlink(name);
+    }
+  }
+}
+
+// big writes from several processes at once, each split into
+// operations as large as the log allows, must wait for room in
+// the log rather than overrun it, and all land.
+void
+bigops(char *s)
+{
+  enum { NCHILD = 3, NBLK = 64 };
+  char name[3];
+  char *p;
+  int ci, i, fd, pid, xstatus;
+
+  name[0] = 'b';
+  name[2] = '\0';
+  for(ci = 0; ci < NCHILD; ci++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[1] = 'o' + ci;
+      p = sbrk(NBLK*BSIZE);
+      if(p == (char*)-1){
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+      }
+      for(i = 0; i < NBLK*BSIZE/sizeof(int); i++)
+        ((int*)p)[i] = (ci << 20) + i;
+      fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+      if(fd < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      if(write(fd, p, NBLK*BSIZE) != NBLK*BSIZE){
+        printf("%s: write %s failed\n", s, name);
+        exit(1);
+      }
+      close(fd);
+      checktag(s, name, NBLK, ci << 20, BUFSZ);
+      unlink(name);
+      exit(0);
+    }
+  }
+  for(ci = 0; ci < NCHILD; ci++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+}
+
+// blocks that writes overwrite whole are not zeroed first; no
+// byte of whatever they held before may show, whatever the mix
+// of partial, whole-block, multi-block and failing writes.
+void
+freshblocks(char *s)
+{
+  static int sizes[] = { 100, BSIZE, BSIZE/2, 2*BSIZE - 100 - BSIZE/2,
+                         4*BSIZE, 1, BSIZE - 1, 3*BSIZE + 5, BSIZE - 5, 0 };
+  int fd, i, j, n, off;
+
+  // leave stale data in free blocks.
+  fd = open("stale", O_CREATE|O_WRONLY|O_TRUNC);
+  memset(buf, 'S', BUFSZ);
+  for(i = 0; i < 3; i++)
+    write(fd, buf, BUFSZ);
+  close(fd);
+  unlink("stale");
+
+  fd = open("freshf", O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("%s: create freshf failed\n", s);
+    exit(1);
+  }
+  fsync(fd);  // and wait for stale's blocks to be freed
+  off = 0;
+  for(i = 0; sizes[i]; i++){
+    n = sizes[i];
+    for(j = 0; j < n; j++)
+      buf[j] = 'a' + (off + j) % 23;
+    if(write(fd, buf, n) != n){
+      printf("%s: write of %d failed\n", s, n);
+      exit(1);
+    }
+    off += n;
+    // a write from a bad address, of whole new blocks.
+    if(off % BSIZE == 0 && write(fd, (char*)0xffffffffffL, 2*BSIZE) > 0){
+      printf("%s: write from a bad address succeeded\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("freshf", O_RDONLY);
+  for(j = 0; (n = read(fd, buf, BSIZE)) > 0; j += n){
+    for(i = 0; i < n; i++){
+      if(buf[i] != 'a' + (j + i) % 23){
+        printf("%s: freshf byte %d is %x\n", s, j + i, buf[i]);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  unlink("freshf");
+  if(j != off){
+    printf("%s: freshf is %d bytes, not %d\n", s, j, off);
+    exit(1);
+  }
+}
+
+// lookups go through a cache of names, which unlink(), link(),
+// and directories that go and come back must keep in step.
+int
+dcexists(char *path)
+{
+  struct stat st;
+
+  return stat(path, &st) == 0;
+}
+
+void
+dcmake(char *s, char *path, char *data)
+{
+  int fd;
+
+  fd = open(path, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0 || write(fd, data, strlen(data)) != strlen(data)){
+    printf("%s: create %s failed\n", s, path);
+    exit(1);
+  }
+  close(fd);
+}
+
+void
+dcachetest(char *s)
+{
+  char *long1 = "dc/a-name-longer-than-the-cache-keeps";
+  char data[8];
+  int fd, pid, xstatus;
+
+  if(mkdir("dc") < 0){
+    printf("%s: mkdir dc failed\n", s);
+    exit(1);
+  }
+
+  // a cached name goes away.
+  dcmake(s, "dc/a", "a");
+  if(!dcexists("dc/a") || unlink("dc/a") < 0 || dcexists("dc/a")){
+    printf("%s: dc/a still found after unlink\n", s);
+    exit(1);
+  }
+
+  // a name cached as missing appears.
+  if(dcexists("dc/b")){
+    printf("%s: dc/b found before it was made\n", s);
+    exit(1);
+  }
+  dcmake(s, "dc/b", "b");
+  if(!dcexists("dc/b")){
+    printf("%s: dc/b not found after create\n", s);
+    exit(1);
+  }
+
+  // a rename, by link and unlink.
+  if(link("dc/b", "dc/c") < 0 || unlink("dc/b") < 0){
+    printf("%s: rename dc/b failed\n", s);
+    exit(1);
+  }
+  fd = open("dc/c", O_RDONLY);
+  if(fd < 0 || read(fd, data, sizeof(data)) != 1 || data[0] != 'b' || dcexists("dc/b")){
+    printf("%s: rename dc/b to dc/c went wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // a directory removed and made again has none of the old names,
+  // though it may well get the same inode.
+  if(mkdir("dc/d") < 0){
+    printf("%s: mkdir dc/d failed\n", s);
+    exit(1);
+  }
+  dcmake(s, "dc/d/x", "x");
+  if(!dcexists("dc/d/x") || unlink("dc/d/x") < 0 || unlink("dc/d") < 0){
+    printf("%s: cannot remove dc/d\n", s);
+    exit(1);
+  }
+  if(mkdir("dc/d") < 0){
+    printf("%s: mkdir dc/d again failed\n", s);
+    exit(1);
+  }
+  if(dcexists("dc/d/x") || chdir("dc/d") < 0 || !dcexists("../c") || chdir("/") < 0){
+    printf("%s: new dc/d is wrong\n", s);
+    exit(1);
+  }
+
+  // another process removes a name this one has looked up.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(!dcexists("dc/c") || unlink("dc/c") < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || dcexists("dc/c")){
+    printf("%s: dc/c still found after another process unlinked it\n", s);
+    exit(1);
+  }
+
+  // names too long to be cached still work.
+  dcmake(s, long1, "l");
+  if(!dcexists(long1) || unlink(long1) < 0 || dcexists(long1)){
+    printf("%s: long name went wrong\n", s);
+    exit(1);
+  }
+
+  if(unlink("dc/d") < 0 || unlink("dc") < 0){
+    printf("%s: cannot remove dc\n", s);
+    exit(1);
+  }
+}
+
+// the inode table may grow well past its initial size; a wrong
+// limit leaves it stuck at NINODE.
+void
+icachelimit(char *s)
+{
+  struct icachestat st;
+
+  if(icachestat(&st) < 0){
+    printf("%s: icachestat failed\n", s);
+    exit(1);
+  }
+  if(st.min < NINODE || st.ninode < st.min || st.max < 4 * st.min){
+    printf("%s: inode table min %d ninode %d max %d\n", s, st.min, st.ninode, st.max);
+    exit(1);
+  }
+}
+
+// write a file that reaches into the doubly-indirect blocks.
 void
 writebig(char *s)
 {
   int i, fd, n;
+  enum { NBIG = NDIRECT + NINDIRECT + 64 };
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -589,7 +1338,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +1358,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -1397,12 +2146,10 @@ concreate(char *s)
 {
   enum { N = 40 };
   char file[3];
-  int i, pid, n, fd;
+  int i, pid, n, fd, o;
   char fa[N];
-  struct {
-    ushort inum;
-    char name[DIRSIZ];
-  } de;
+  static char blk[BSIZE];
+  struct dirent *de;
 
   file[0] = 'C';
   file[2] = '\0';
@@ -1435,21 +2182,28 @@ concreate(char *s)
   memset(fa, 0, sizeof(fa));
   fd = open(".", 0);
   n = 0;
-  while(read(fd, &de, sizeof(de)) > 0){
-    if(de.inum == 0)
-      continue;
-    if(de.name[0] == 'C' && de.name[2] == '\0'){
-      i = de.name[1] - '0';
-      if(i < 0 || i >= sizeof(fa)){
-        printf("%s: concreate weird file %s\n", s, de.name);
+  while(read(fd, blk, sizeof(blk)) == sizeof(blk)){
+    for(o = 0; o < sizeof(blk); o += de->reclen){
+      de = (struct dirent*)(blk + o);
+      if(de->reclen == 0){
+        printf("%s: concreate bad directory record\n", s);
         exit(1);
       }
-      if(fa[i]){
-        printf("%s: concreate duplicate file %s\n", s, de.name);
-        exit(1);
+      if(de->inum == 0)
+        continue;
+      if(de->namelen == 2 && de->name[0] == 'C'){
+        i = de->name[1] - '0';
+        if(i < 0 || i >= sizeof(fa)){
+          printf("%s: concreate weird file C%c\n", s, de->name[1]);
+          exit(1);
+        }
+        if(fa[i]){
+          printf("%s: concreate duplicate file C%c\n", s, de->name[1]);
+          exit(1);
+        }
+        fa[i] = 1;
+        n++;
       }
-      fa[i] = 1;
-      n++;
     }
   }
   close(fd);
@@ -1781,50 +2535,96 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// names up to DIRSIZ long, longer ones truncated.
 void
-fourteen(char *s)
+longname(char *s)
 {
-  int fd;
+  enum { N = 20, LEN = 200 };
+  char name[DIRSIZ+2], path[MAXPATH];
+  int fd, i;
 
-  // DIRSIZ is 14.
+  // DIRSIZ is 255.
+  memset(name, 'a', DIRSIZ+1);
+  name[DIRSIZ+1] = '\0';
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
-    exit(1);
-  }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  if(mkdir(name) != 0){
+    printf("%s: mkdir of a %d-byte name failed\n", s, DIRSIZ+1);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  strcpy(path, name);
+  strcpy(path + DIRSIZ + 1, "/f");
+  fd = open(path, O_CREATE);
   if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    printf("%s: create of %d-byte name/f failed\n", s, DIRSIZ+1);
     exit(1);
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  name[DIRSIZ] = '\0';
+  strcpy(path, name);
+  strcpy(path + DIRSIZ, "/f");
+  fd = open(path, 0);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: open of %d-byte name/f failed\n", s, DIRSIZ);
     exit(1);
   }
   close(fd);
-
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+  name[DIRSIZ] = 'a';
+  if(mkdir(name) == 0){
+    printf("%s: mkdir of a truncated name succeeded!\n", s);
     exit(1);
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  name[DIRSIZ] = '\0';
+  if(unlink(path) != 0 || unlink(name) != 0){
+    printf("%s: unlink of %d-byte name failed\n", s, DIRSIZ);
     exit(1);
   }
 
-  // clean up
-  unlink("123456789012345/12345678901234");
-  unlink("12345678901234/12345678901234");
-  unlink("12345678901234/12345678901234/12345678901234");
-  unlink("123456789012345/123456789012345/123456789012345");
-  unlink("12345678901234/123456789012345");
-  unlink("12345678901234");
+  // many long names in one directory, removed out of order.
+  if(mkdir("ldir") != 0){
+    printf("%s: mkdir ldir failed\n", s);
+    exit(1);
+  }
+  strcpy(path, "ldir/");
+  memset(path + 5, 'x', LEN);
+  path[5 + LEN + 1] = '\0';
+  for(i = 0; i < N; i++){
+    path[5 + LEN] = 'a' + i;
+    fd = open(path, O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: create ldir/x..%c failed\n", s, 'a' + i);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < N; i += 2){
+    path[5 + LEN] = 'a' + i;
+    if(unlink(path) != 0){
+      printf("%s: unlink ldir/x..%c failed\n", s, 'a' + i);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    path[5 + LEN] = 'a' + i;
+    fd = open(path, 0);
+    if((fd >= 0) != (i % 2)){
+      printf("%s: ldir/x..%c %s\n", s, 'a' + i, fd >= 0 ? "still there" : "missing");
+      exit(1);
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  if(unlink("ldir") == 0){
+    printf("%s: unlink non-empty ldir succeeded!\n", s);
+    exit(1);
+  }
+  for(i = 1; i < N; i += 2){
+    path[5 + LEN] = 'a' + i;
+    unlink(path);
+  }
+  if(unlink("ldir") != 0){
+    printf("%s: unlink empty ldir failed\n", s);
+    exit(1);
+  }
 }
 
 void
@@ -2604,6 +3404,19 @@ struct test {
   {iputtest, "iput"},
   {opentest, "opentest"},
   {writetest, "writetest"},
+  {fsynctest, "fsynctest"},
+  {inlinetest, "inlinetest"},
+  {alloclocal, "alloclocal"},
+  {freshblocks, "freshblocks"},
+  {icachelimit, "icachelimit"},
+  {bcachebuckets, "bcachebuckets"},
+  {bcachegrow, "bcachegrow"},
+  {readahead, "readahead"},
+  {diskconc, "diskconc"},
+  {diskruns, "diskruns"},
+  {groupcommit, "groupcommit"},
+  {bigops, "bigops"},
+  {dcachetest, "dcache"},
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
@@ -2628,7 +3441,7 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
-  {fourteen, "fourteen"},
+  {longname, "longname"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
   {iref, "iref"},
@@ -2699,6 +3512,97 @@ bigdir(char *s)
   }
 }
 
+// a directory big enough to get a hash index: lookups must find
+// every entry, and deletions and re-creations must keep the
+// index in step with the directory.
+void
+dhname(char *name, int i)
+{
+  strcpy(name, "dh/dirhash-entry-000");
+  name[17] = '0' + i / 100;
+  name[18] = '0' + i / 10 % 10;
+  name[19] = '0' + i % 10;
+}
+
+void
+dirhash(char *s)
+{
+  enum { N = 3*BSIZE/16 };  // 24 bytes per entry: over 2*BSIZE
+  char name[32];
+  struct stat st;
+  int i, fd, pass;
+
+  if(mkdir("dh") < 0){
+    printf("%s: mkdir dh failed\n", s);
+    exit(1);
+  }
+  fd = open("dh/target", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create dh/target failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    dhname(name, i);
+    if(link("dh/target", name) < 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  for(pass = 0; pass < 2; pass++){
+    for(i = 0; i < N; i++){
+      dhname(name, i);
+      if(stat(name, &st) < 0){
+        printf("%s: %s not found\n", s, name);
+        exit(1);
+      }
+    }
+    if(st.nlink != N + 1){
+      printf("%s: nlink %d, not %d\n", s, st.nlink, N + 1);
+      exit(1);
+    }
+    dhname(name, N);
+    if(stat(name, &st) == 0){
+      printf("%s: found %s, which does not exist\n", s, name);
+      exit(1);
+    }
+
+    // delete every other entry, then make them again.
+    for(i = pass; i < N; i += 2){
+      dhname(name, i);
+      if(unlink(name) < 0){
+        printf("%s: unlink %s failed\n", s, name);
+        exit(1);
+      }
+    }
+    for(i = 0; i < N; i++){
+      dhname(name, i);
+      if((stat(name, &st) == 0) != (i % 2 != pass)){
+        printf("%s: %s wrongly %s\n", s, name, i % 2 == pass ? "found" : "missing");
+        exit(1);
+      }
+    }
+    for(i = pass; i < N; i += 2){
+      dhname(name, i);
+      if(link("dh/target", name) < 0){
+        printf("%s: relink %s failed\n", s, name);
+        exit(1);
+      }
+    }
+  }
+
+  for(i = 0; i < N; i++){
+    dhname(name, i);
+    unlink(name);
+  }
+  unlink("dh/target");
+  if(unlink("dh") < 0){
+    printf("%s: unlink dh failed, not empty?\n", s);
+    exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -2852,7 +3756,6 @@ diskfull(char *s)
       break;
     }
     for(int i = 0; i < MAXFILE; i++){
-      char buf[BSIZE];
       if(write(fd, buf, BSIZE) != BSIZE){
         done = 1;
         close(fd);
@@ -2939,13 +3842,221 @@ outofinodes(char *s)
   }
 }
 
+// a write that runs out of blocks part way must keep what it
+// wrote, leave a new file empty, and leak nothing.
+int
+fullwrite_fill(char *s, char *name)
+{
+  int fd, i, n;
+
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("%s: create %s failed\n", s, name);
+    exit(1);
+  }
+  for(n = 0; ; n += BUFSZ/BSIZE){
+    for(i = 0; i < BUFSZ/BSIZE; i++)
+      memset(buf + i*BSIZE, 'a' + (n + i) % 26, BSIZE);
+    if(write(fd, buf, BUFSZ) != BUFSZ)
+      break;
+  }
+  close(fd);
+  return n;
+}
+
+// does the file name hold n blocks or more, block i filled with
+// 'a' + i % 26? returns how many.
+int
+fullwrite_check(char *s, char *name, int n)
+{
+  struct stat st;
+  int fd, i, j;
+
+  fd = open(name, O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0){
+    printf("%s: open %s failed\n", s, name);
+    exit(1);
+  }
+  if(st.size % BSIZE != 0 || st.size < n * BSIZE){
+    printf("%s: %s has size %d, not %d blocks\n", s, name, (int)st.size, n);
+    exit(1);
+  }
+  for(i = 0; read(fd, buf, BSIZE) == BSIZE; i++){
+    for(j = 0; j < BSIZE; j++){
+      if(buf[j] != 'a' + i % 26){
+        printf("%s: %s block %d is wrong\n", s, name, i);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  return i;
+}
+
+void
+fullwrite(char *s)
+{
+  int fd, n, n1, n2;
+
+  unlink("fullf");
+  unlink("fullf2");
+  // create fullf2 while its directory entry can still get a block.
+  close(open("fullf2", O_CREATE|O_WRONLY));
+  n = fullwrite_fill(s, "fullf");
+  n = fullwrite_check(s, "fullf", n);
+
+  // no blocks for an empty file.
+  fd = open("fullf2", O_WRONLY);
+  if(fd < 0){
+    printf("%s: create fullf2 failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', BSIZE);
+  if(write(fd, buf, BSIZE) == BSIZE){
+    printf("%s: write to a full disk succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fullwrite_check(s, "fullf2", 0) != 0){
+    printf("%s: fullf2 is not empty\n", s);
+    exit(1);
+  }
+
+  // truncated, the file's blocks all come back.
+  n1 = fullwrite_fill(s, "fullf");
+  n1 = fullwrite_check(s, "fullf", n1);
+  if(n1 < n){
+    printf("%s: lost %d blocks\n", s, n - n1);
+    exit(1);
+  }
+
+  // and so they do for another file, and back again.
+  fd = open("fullf", O_WRONLY|O_TRUNC);
+  close(fd);
+  n2 = fullwrite_fill(s, "fullf2");
+  fullwrite_check(s, "fullf2", n2);
+  unlink("fullf2");
+  n2 = fullwrite_fill(s, "fullf");
+  n2 = fullwrite_check(s, "fullf", n2);
+  unlink("fullf");
+  if(n2 < n){
+    printf("%s: lost %d blocks\n", s, n - n2);
+    exit(1);
+  }
+}
+
+// O_TRUNC of a big file while another process writes it. The
+// writer must never see blocks the truncation is freeing, and
+// when the file goes, every block must come back. The file is
+// as big as the disk allows, up to more than one bitmap block's
+// worth; with a file system that has several bitmap blocks
+// (e.g. MKFSFLAGS="-s 70000") it spans more than one.
+int
+truncwrite_fill(char *s, char *name)
+{
+  int fd, n;
+
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("%s: create %s failed\n", s, name);
+    exit(1);
+  }
+  memset(buf, 'f', BSIZE);
+  for(n = 0; n < BPB + NDIRECT; n++)
+    if(write(fd, buf, BSIZE) != BSIZE)
+      break;
+  close(fd);
+  return n;
+}
+
+void
+truncwrite(char *s)
+{
+  int fd, pid, xstatus, i, n, n1;
+
+  unlink("truncw");
+  n = truncwrite_fill(s, "truncw");
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    memset(buf, 'w', BSIZE);
+    for(i = 0; i < 100; i++){
+      fd = open("truncw", O_WRONLY);
+      if(fd < 0){
+        printf("%s: open truncw failed\n", s);
+        exit(1);
+      }
+      // fails once a truncation leaves the offset past the end.
+      for(n1 = 0; n1 < 4; n1++)
+        if(write(fd, buf, BSIZE) != BSIZE)
+          break;
+      close(fd);
+    }
+    exit(0);
+  }
+
+  for(i = 0; i < 20; i++){
+    fd = open("truncw", O_WRONLY|O_TRUNC);
+    if(fd < 0){
+      printf("%s: open truncw O_TRUNC failed\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // nothing of the old contents may show through.
+  fd = open("truncw", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open truncw failed\n", s);
+    exit(1);
+  }
+  while((n1 = read(fd, buf, BSIZE)) > 0){
+    for(i = 0; i < n1; i++){
+      if(buf[i] != 0 && buf[i] != 'w'){
+        printf("%s: truncw has stale data %x\n", s, buf[i]);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+
+  unlink("truncw");
+  fd = open("truncw.f", O_CREATE|O_WRONLY);
+  if(fd < 0 || fsync(fd) < 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("truncw.f");
+
+  // if the first file filled the disk, so must a second.
+  if(n < BPB + NDIRECT){
+    n1 = truncwrite_fill(s, "truncw");
+    unlink("truncw");
+    if(n1 < n){
+      printf("%s: leaked %d blocks\n", s, n - n1);
+      exit(1);
+    }
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {dirhash, "dirhash"},
   {manywrites, "manywrites"},
   {badwrite, "badwrite" },
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {fullwrite, "fullwrite"},
+  {truncwrite, "truncwrite"},
     
   { 0, 0},
 };
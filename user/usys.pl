@@ -45,3 +45,13 @@ entry("grouplock_release");
 entry("grouplock_destroy");
 entry("grouplock_verify");
 entry("grouplock_debug");
+entry("grouplock_open");
+entry("grouplock_wake");
+entry("grouplock_get");
+entry("grouplock_stats");
+entry("bcachestat");
+entry("bcachesize");
+entry("fsync");
+entry("icachestat");
+entry("logcrash");
+entry("fbmap");